@@ -0,0 +1,480 @@
+/* -*- Mode: C; tab-width: 2; c-basic-offset: 2 -*- */
+/* vim:set softtabstop=2 shiftwidth=2: */
+/*
+ * choice-bench -- how fast is the dyslexic option parser?
+ *
+ * Generates option tables of 10 to 10,000 random names and argument
+ * vectors that spell them exactly, abbreviate them or misspell them at
+ * a given rate, then measures `option_parse`, `option_table_parse`,
+ * `subopt_parse` and the comparators against them. Every row reports
+ * nanoseconds per argument (or call), distance cells evaluated,
+ * allocations per parse and the peak RSS so far. `getopt_long`, which
+ * knows exact names and unique prefixes only, parses the same vectors
+ * as a baseline.
+ *
+ * The library is compiled right into this file, so that the cells and
+ * allocations can be counted without touching a release build.
+ *
+ * ---------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Jonas Pommerening <jonas.pommerening@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR
+ * CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES;  LOSS OF USE, DATA, OR PROFITS;  OR BUSINESS
+ * INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  WHETHER IN
+ * CONTRACT,  STRICT LIABILITY,  OR TORT  (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdlib.h>
+
+/* count what the library allocates and how many cells it evaluates */
+static unsigned long long bench_allocations = 0;
+static unsigned long long bench_cells = 0;
+#define malloc(size) (bench_allocations++, malloc(size))
+#define calloc(count, size) (bench_allocations++, calloc(count, size))
+#define realloc(ptr, size) (bench_allocations++, realloc(ptr, size))
+#define CHOICE_CELLS(n) (bench_cells += (n))
+
+#include "choice.c"
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#define BENCH_ARGS 1000
+#define BENCH_SUBOPTS 100
+
+static struct {
+  bool help;
+  bool quick;
+  long budget;
+  long seed;
+} config = {
+  false,
+  false,
+  200,
+  1
+};
+
+static option_t options[] = {
+  { "help", "display help", 'h', 0, &option_true, &config.help },
+  { "quick", "measure for 20ms instead", 'q', 0, &option_true, &config.quick },
+  { "budget", "milliseconds per measurement", 'b', OPTION_REQARG, &option_long, &config.budget },
+  { "seed", "random seed", 's', OPTION_REQARG, &option_long, &config.seed },
+  OPTION_EOL
+};
+
+/** A mix of argument spellings: shares of abbreviations and typos, in percent. */
+typedef struct mix_s {
+  const char* name;
+  int prefix;
+  int typo;
+} mix_t;
+
+static const mix_t mixes[] = {
+  { "exact", 0, 0 },
+  { "prefix", 100, 0 },
+  { "typo 10%", 0, 10 },
+  { "typo 50%", 0, 50 },
+  { "mixed", 30, 30 },
+  { "fuzzy", 0, 100 }
+};
+
+/** What one measurement came up with. */
+typedef struct result_s {
+  double ns;
+  double cells;
+  double allocations;
+  unsigned long long runs;
+} result_t;
+
+static unsigned long long state;
+
+/** xorshift64*, so that every run sees the same tables. */
+static unsigned long long bench_random( void ) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ull;
+}
+
+static unsigned bench_below( unsigned n ) {
+  return (unsigned) (bench_random() % n);
+}
+
+static unsigned long long bench_now( void ) {
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return (unsigned long long) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static long bench_rss( void ) {
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+  return usage.ru_maxrss;
+}
+
+static int bench_strcmp( const void* a, const void* b ) {
+  return strcmp( *(const char* const*) a, *(const char* const*) b );
+}
+
+/** Make up a name of 4 to 15 letters (and the odd dash). */
+static void bench_name( char* name ) {
+  unsigned k, len = 4 + bench_below( 12 );
+  for( k = 0; k < len; k++ )
+    name[k] = (k > 1 && k < len - 2 && bench_below( 8 ) == 0) ? '-' : 'a' + bench_below( 26 );
+  name[len] = '\0';
+}
+
+/** Make `count` options with unique names, in no particular order. */
+static option_t* bench_options( unsigned count ) {
+  option_t* opts = calloc( count + 1, sizeof(option_t) );
+  char** names = calloc( count, sizeof(char*) );
+  char* tmp;
+  unsigned i, k;
+  bool again;
+
+  for( i = 0; i < count; i++ )
+    bench_name( names[i] = malloc( 16 ) );
+  do {
+    qsort( names, count, sizeof(char*), &bench_strcmp );
+    again = false;
+    for( k = 1; k < count; k++ ) {
+      if( strcmp( names[k - 1], names[k] ) == 0 ) {
+        bench_name( names[k] );
+        again = true;
+      }
+    }
+  } while( again );
+
+  for( i = count; i > 1; i-- ) {
+    k = bench_below( i );
+    tmp = names[i - 1], names[i - 1] = names[k], names[k] = tmp;
+  }
+  for( i = 0; i < count; i++ ) {
+    opts[i].name = names[i];
+    opts[i].desc = "";
+  }
+  free( names );
+  return opts;
+}
+
+static void bench_options_free( option_t* opts ) {
+  option_t* option;
+  for( option = opts; option->name != NULL; option++ )
+    free( (char*) option->name );
+  free( opts );
+}
+
+/** Misspell `name` into `out` with one random swap, substitution, insertion or deletion. */
+static void bench_typo( const char* name, char* out ) {
+  size_t len = strlen( name ), at = bench_below( len );
+  char c = 'a' + bench_below( 26 );
+
+  switch( bench_below( 4 ) ) {
+    case 0:
+      if( at + 1 < len ) {
+        memcpy( out, name, len + 1 );
+        out[at] = name[at + 1];
+        out[at + 1] = name[at];
+        break;
+      }
+    case 1:
+      memcpy( out, name, len + 1 );
+      out[at] = c;
+      break;
+    case 2:
+      memcpy( out, name, at );
+      out[at] = c;
+      memcpy( out + at + 1, name + at, len - at + 1 );
+      break;
+    default:
+      memcpy( out, name, at );
+      memcpy( out + at, name + at + 1, len - at );
+      break;
+  }
+}
+
+/**
+ * Make `BENCH_ARGS` arguments spelled according to `mix`. An abbreviation
+ * or typo that does not lead back to its option is spelled out instead.
+ */
+static char** bench_args( const option_table_t* table, const mix_t* mix ) {
+  char** argv = calloc( BENCH_ARGS + 1, sizeof(char*) );
+  option_t* option;
+  option_t* ambig;
+  const char* name;
+  unsigned i, roll;
+  size_t len;
+
+  argv[0] = strdup( "bench" );
+  for( i = 1; i <= BENCH_ARGS; i++ ) {
+    option = &(table->options[bench_below( table->count )]);
+    name = option->name;
+    len = strlen( name );
+    argv[i] = malloc( len + 4 );
+    argv[i][0] = argv[i][1] = '-';
+    roll = bench_below( 100 );
+
+    if( roll < mix->prefix ) {
+      len = len / 2 + bench_below( len - len / 2 );
+      memcpy( argv[i] + 2, name, len );
+      argv[i][len + 2] = '\0';
+    } else if( roll < mix->prefix + mix->typo ) {
+      bench_typo( name, argv[i] + 2 );
+    } else {
+      strcpy( argv[i] + 2, name );
+    }
+    if( option_lookup( table, 0, argv[i] + 2, strlen( argv[i] + 2 ), &ambig ) != option )
+      strcpy( argv[i] + 2, name );
+  }
+  return argv;
+}
+
+static void bench_args_free( char** argv ) {
+  int i;
+  for( i = 0; i <= BENCH_ARGS; i++ )
+    free( argv[i] );
+  free( argv );
+}
+
+/**
+ * Call `run` until the time budget is spent, and work out the cost of
+ * one of `per` units (arguments, items or calls) of a run.
+ */
+static result_t bench_measure( int (*run)( void* ), void* context, unsigned per ) {
+  unsigned long long budget = (unsigned long long) config.budget * 1000000ull;
+  unsigned long long start, spent, allocs = bench_allocations, counted = bench_cells;
+  result_t result = { 0, 0, 0, 0 };
+
+  start = bench_now();
+  do {
+    run( context );
+    result.runs++;
+  } while( (spent = bench_now() - start) < budget );
+
+  result.ns = (double) spent / result.runs / per;
+  result.cells = (double) (bench_cells - counted) / result.runs / per;
+  result.allocations = (double) (bench_allocations - allocs) / result.runs;
+  return result;
+}
+
+static void bench_report( const char* what, unsigned size, const char* mix, result_t result ) {
+  printf( "%-20s %6u  %-9s %10.1f %10.1f %10.1f %8ld\n", what, size, mix,
+          result.ns, result.cells, result.allocations, bench_rss() );
+}
+
+/* MARK: parsing */
+
+typedef struct parse_s {
+  option_t* options;
+  option_table_t* table;
+  struct option* longopts;
+  char** args;
+  char** argv;
+  unsigned unresolved;
+} parse_t;
+
+static int bench_option_parse( void* context ) {
+  parse_t* parse = context;
+  memcpy( parse->argv, parse->args, (BENCH_ARGS + 1) * sizeof(char*) );
+  return option_parse( parse->options, BENCH_ARGS + 1, parse->argv );
+}
+
+static int bench_table_parse( void* context ) {
+  parse_t* parse = context;
+  memcpy( parse->argv, parse->args, (BENCH_ARGS + 1) * sizeof(char*) );
+  return option_table_parse( parse->table, BENCH_ARGS + 1, parse->argv );
+}
+
+static int bench_getopt_long( void* context ) {
+  parse_t* parse = context;
+  int c;
+  memcpy( parse->argv, parse->args, (BENCH_ARGS + 1) * sizeof(char*) );
+  optind = 0;
+  opterr = 0;
+  parse->unresolved = 0;
+  while( (c = getopt_long( BENCH_ARGS + 1, parse->argv, "", parse->longopts, NULL )) != -1 )
+    parse->unresolved += (c == '?');
+  return 0;
+}
+
+static void bench_parsing( void ) {
+  static const unsigned sizes[] = { 10, 100, 1000, 10000 };
+  option_table_t table;
+  parse_t parse;
+  result_t result;
+  unsigned s, m, i;
+  char label[32];
+
+  printf( "%-20s %6s  %-9s %10s %10s %10s %8s\n",
+          "parse", "table", "args", "ns/arg", "cells/arg", "allocs", "rss kB" );
+  for( s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++ ) {
+    parse.options = bench_options( sizes[s] );
+    parse.table = &table;
+    option_table_init( &table, parse.options );
+    parse.longopts = calloc( sizes[s] + 1, sizeof(struct option) );
+    for( i = 0; i < sizes[s]; i++ ) {
+      parse.longopts[i].name = parse.options[i].name;
+      parse.longopts[i].has_arg = no_argument;
+      parse.longopts[i].val = 1;
+    }
+    parse.argv = calloc( BENCH_ARGS + 1, sizeof(char*) );
+
+    for( m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++ ) {
+      parse.args = bench_args( &table, &(mixes[m]) );
+      bench_report( "option_parse", sizes[s], mixes[m].name,
+                    bench_measure( &bench_option_parse, &parse, BENCH_ARGS ) );
+      bench_report( "option_table_parse", sizes[s], mixes[m].name,
+                    bench_measure( &bench_table_parse, &parse, BENCH_ARGS ) );
+      result = bench_measure( &bench_getopt_long, &parse, BENCH_ARGS );
+      snprintf( label, sizeof(label), "getopt_long (%u?)", parse.unresolved );
+      bench_report( label, sizes[s], mixes[m].name, result );
+      bench_args_free( parse.args );
+    }
+
+    free( parse.argv );
+    free( parse.longopts );
+    option_table_free( &table );
+    bench_options_free( parse.options );
+  }
+}
+
+/* MARK: suboptions */
+
+typedef struct subopt_s {
+  option_t* options;
+  char* blob;
+  char* copy;
+  size_t len;
+} subopt_t;
+
+static int bench_subopt_parse( void* context ) {
+  subopt_t* subopt = context;
+  memcpy( subopt->copy, subopt->blob, subopt->len + 1 );
+  return subopt_parse( subopt->options, subopt->copy );
+}
+
+static void bench_suboptions( void ) {
+  static const unsigned items[] = { 10, 1000, 100000 };
+  subopt_t subopt;
+  option_t* option;
+  unsigned s, i, count;
+  size_t len;
+  char label[32];
+
+  subopt.options = bench_options( BENCH_SUBOPTS );
+  for( option = subopt.options; option->name != NULL; option++ )
+    option->flags = OPTION_NODASH | OPTION_OPTARG;
+  for( count = 0; subopt.options[count].name != NULL; count++ );
+
+  printf( "\n%-20s %6s  %-9s %10s %10s %10s %8s\n",
+          "subopt", "table", "items", "ns/item", "cells/item", "allocs", "rss kB" );
+  for( s = 0; s < sizeof(items) / sizeof(items[0]); s++ ) {
+    subopt.blob = malloc( items[s] * 32 );
+    subopt.copy = malloc( items[s] * 32 );
+    for( i = 0, len = 0; i < items[s]; i++ ) {
+      len += sprintf( subopt.blob + len, "%s%s", i ? "," : "", subopt.options[bench_below( count )].name );
+      if( bench_below( 2 ) )
+        len += sprintf( subopt.blob + len, "=%u", bench_below( 100000 ) );
+    }
+    subopt.len = len;
+    snprintf( label, sizeof(label), "%u", items[s] );
+    bench_report( "subopt_parse", count, label,
+                  bench_measure( &bench_subopt_parse, &subopt, items[s] ) );
+    free( subopt.blob );
+    free( subopt.copy );
+  }
+  bench_options_free( subopt.options );
+}
+
+/* MARK: comparators */
+
+typedef struct compare_s {
+  int (*compare)( const char* target, const char* str );
+  const char** targets;
+  char** strs;
+  int sum;
+} compare_t;
+
+static int bench_compare( void* context ) {
+  compare_t* compare = context;
+  unsigned i;
+  for( i = 0; i < BENCH_ARGS; i++ )
+    compare->sum += (compare->compare)( compare->targets[i], compare->strs[i] );
+  return 0;
+}
+
+static void bench_comparators( void ) {
+  option_t* opts = bench_options( BENCH_ARGS );
+  compare_t compare;
+  unsigned i, m;
+
+  compare.targets = calloc( BENCH_ARGS, sizeof(char*) );
+  compare.strs = calloc( BENCH_ARGS, sizeof(char*) );
+  for( i = 0; i < BENCH_ARGS; i++ )
+    compare.strs[i] = malloc( 20 );
+
+  printf( "\n%-20s %6s  %-9s %10s %10s %10s %8s\n",
+          "compare", "pairs", "strs", "ns/call", "cells/call", "allocs", "rss kB" );
+  for( m = 0; m < 3; m++ ) {
+    for( i = 0; i < BENCH_ARGS; i++ ) {
+      compare.targets[i] = opts[i].name;
+      if( m == 0 )
+        strcpy( compare.strs[i], opts[i].name );
+      else if( m == 1 )
+        bench_typo( opts[i].name, compare.strs[i] );
+      else
+        strcpy( compare.strs[i], opts[bench_below( BENCH_ARGS )].name );
+    }
+    compare.compare = &choice_fuzzycmp;
+    bench_report( "choice_fuzzycmp", BENCH_ARGS, (m == 0) ? "equal" : (m == 1) ? "typo" : "random",
+                  bench_measure( &bench_compare, &compare, BENCH_ARGS ) );
+    compare.compare = &choice_prefixcmp;
+    bench_report( "choice_prefixcmp", BENCH_ARGS, (m == 0) ? "equal" : (m == 1) ? "typo" : "random",
+                  bench_measure( &bench_compare, &compare, BENCH_ARGS ) );
+  }
+
+  for( i = 0; i < BENCH_ARGS; i++ )
+    free( compare.strs[i] );
+  free( compare.strs );
+  free( compare.targets );
+  bench_options_free( opts );
+}
+
+int main( int argc, char* argv[] ) {
+  option_t* option;
+  int error;
+
+  if( (error = option_parse( options, argc, argv )) )
+    return error;
+  if( config.help ) {
+    printf( "usage: choice-bench [options]\n\noptions:\n" );
+    for( option = options; option->name != NULL; option++ )
+      option_help( option, NULL );
+    return 0;
+  }
+  if( config.quick )
+    config.budget = 20;
+  state = (unsigned long long) config.seed * 0x9e3779b97f4a7c15ull + 1;
+
+  bench_parsing();
+  bench_suboptions();
+  bench_comparators();
+  return 0;
+}
@@ -0,0 +1,408 @@
+/* -*- Mode: C; tab-width: 2; c-basic-offset: 2 -*- */
+/* vim:set softtabstop=2 shiftwidth=2: */
+/*
+ * choice-gen -- compile option tables ahead of time
+ *
+ * Reads a declarative option spec and writes C source with the option
+ * arrays and their compiled `option_table_t`s as static data, so
+ * nothing needs to be computed at startup. Exact names are resolved by
+ * a minimal perfect hash; abbreviations, lanes and the pruning index
+ * are exactly what `option_table_init` would build.
+ *
+ * The spec is line based:
+ *
+ *     # a comment
+ *     #include "config.h"
+ *     table options
+ *     verbose   v  -       option_true  &config.verbose  enable verbose stuff
+ *     required  r  REQARG  option_str   &config.required required arg
+ *
+ * `#include` lines are copied. `table NAME` starts the array `NAME`,
+ * compiled into `NAME_table`. Option lines are name, abbreviation,
+ * flags (`REQARG|NODASH`, ...), callback and data, then the description
+ * as the rest of the line; `-` leaves a field empty. Duplicate names or
+ * abbreviations within a table fail the build.
+ *
+ * ---------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Jonas Pommerening <jonas.pommerening@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR
+ * CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES;  LOSS OF USE, DATA, OR PROFITS;  OR BUSINESS
+ * INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  WHETHER IN
+ * CONTRACT,  STRICT LIABILITY,  OR TORT  (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "choice.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** One option line of the spec, as written. */
+typedef struct entry_s {
+  char* name;
+  char abbr;
+  char* flags;
+  char* callback;
+  char* data;
+  char* desc;
+  int line;
+} entry_t;
+
+/** One `table` of the spec. */
+typedef struct spec_table_s {
+  char* name;
+  entry_t* entries;
+  unsigned count;
+} spec_table_t;
+
+static const char* path;
+
+__attribute__((noreturn))
+static void fail( int line, const char* fmt, const char* str ) {
+  fprintf( stderr, "%s:%i: ", path, line );
+  fprintf( stderr, fmt, str );
+  fprintf( stderr, "\n" );
+  exit( 1 );
+}
+
+static char* dup( const char* str, size_t len ) {
+  char* copy = malloc( len + 1 );
+  if( copy == NULL ) {
+    fprintf( stderr, "out of memory\n" );
+    exit( 1 );
+  }
+  memcpy( copy, str, len );
+  copy[len] = '\0';
+  return copy;
+}
+
+/** Cut the next white space separated field from `*str`, `NULL` for `-`. */
+static char* field( char** str, int line ) {
+  char* start = *str;
+  char* end;
+
+  while( isspace( (unsigned char) *start ) ) start++;
+  if( *start == '\0' )
+    fail( line, "%s", "incomplete option" );
+  for( end = start; *end != '\0' && !isspace( (unsigned char) *end ); end++ );
+  *str = end;
+  return (end - start == 1 && *start == '-') ? NULL : dup( start, end - start );
+}
+
+/** Translate `REQARG|NODASH` into its value. */
+static unsigned flags_value( const char* str, int line ) {
+  static const struct { const char* name; unsigned value; } names[] = {
+    { "REQARG", OPTION_REQARG }, { "OPTARG", OPTION_OPTARG }, { "ARG", OPTION_ARG },
+    { "NODASH", OPTION_NODASH }, { "MULTIPLE", OPTION_MULTIPLE }
+  };
+  unsigned value = 0, i;
+  size_t len;
+
+  while( str != NULL && *str != '\0' ) {
+    len = strcspn( str, "|" );
+    for( i = 0; i < sizeof(names) / sizeof(names[0]); i++ )
+      if( strlen( names[i].name ) == len && strncmp( names[i].name, str, len ) == 0 )
+        break;
+    if( i == sizeof(names) / sizeof(names[0]) )
+      fail( line, "unknown flag in `%s'", str );
+    value |= names[i].value;
+    str += len + (str[len] == '|');
+  }
+  return value;
+}
+
+static void print_string( FILE* out, const char* str ) {
+  if( str == NULL ) {
+    fprintf( out, "NULL" );
+    return;
+  }
+  fputc( '"', out );
+  for( ; *str != '\0'; str++ ) {
+    if( *str == '"' || *str == '\\' )
+      fprintf( out, "\\%c", *str );
+    else if( isprint( (unsigned char) *str ) )
+      fputc( *str, out );
+    else
+      fprintf( out, "\\%03o", (unsigned char) *str );
+  }
+  fputc( '"', out );
+}
+
+static void print_char( FILE* out, char c ) {
+  if( c == '\0' )
+    fprintf( out, "'\\0'" );
+  else if( isalnum( (unsigned char) c ) )
+    fprintf( out, "'%c'", c );
+  else
+    fprintf( out, "(char) %i", (unsigned char) c );
+}
+
+static void print_flags( FILE* out, const char* str ) {
+  size_t len;
+  if( str == NULL ) {
+    fprintf( out, "0" );
+    return;
+  }
+  while( *str != '\0' ) {
+    len = strcspn( str, "|" );
+    fprintf( out, "OPTION_%.*s%s", (int) len, str, str[len] ? "|" : "" );
+    str += len + (str[len] == '|');
+  }
+}
+
+static void print_array( FILE* out, const char* type, const char* table, const char* suffix,
+                         const void* data, size_t size, unsigned count ) {
+  unsigned i;
+  fprintf( out, "static %s %s_%s[] = {", type, table, suffix );
+  for( i = 0; i < count || i == 0; i++ ) {
+    fprintf( out, (i % 12 == 0) ? "\n  " : " " );
+    if( i >= count )
+      fprintf( out, "0" );
+    else if( size == sizeof(unsigned long long) )
+      fprintf( out, "0x%llxull", ((const unsigned long long*) data)[i] );
+    else if( size == sizeof(unsigned) )
+      fprintf( out, "%u", ((const unsigned*) data)[i] );
+    else
+      fprintf( out, "%u", ((const unsigned char*) data)[i] );
+    fprintf( out, "%s", (i + 1 < count) ? "," : "" );
+  }
+  fprintf( out, "\n};\n" );
+}
+
+/**
+ * Find a seed for every bucket of names, such that all names of the
+ * bucket hash to free, distinct slots (largest buckets first). This is
+ * the "hash, displace and compress" scheme, minus the compression.
+ */
+static void perfect_hash( const option_table_t* table, unsigned* seeds, unsigned nseeds,
+                          unsigned* slots, unsigned nslots ) {
+  unsigned* order = calloc( nseeds, sizeof(unsigned) );
+  unsigned* start = calloc( nseeds + 1, sizeof(unsigned) );
+  unsigned* members = calloc( nslots, sizeof(unsigned) );
+  unsigned* taken = calloc( nslots, sizeof(unsigned) );
+  unsigned i, j, k, b, seed, slot, trial = 0;
+  bool ok;
+
+#define BUCKET(i) (choice_hash( table->options[i].name, table->lengths[i], 0 ) % nseeds)
+#define SLOT(i, seed) (choice_hash( table->options[i].name, table->lengths[i], (seed) ) % nslots)
+
+  /* group the names by bucket */
+  for( i = 0; i < table->count; i++ )
+    if( table->options[i].name != NULL )
+      start[BUCKET(i) + 1]++;
+  for( b = 0; b < nseeds; b++ )
+    start[b + 1] += start[b];
+  for( i = 0; i < table->count; i++ )
+    if( table->options[i].name != NULL )
+      members[start[BUCKET(i)]++] = i;
+  for( b = nseeds; b > 0; b-- )
+    start[b] = start[b - 1];
+  start[0] = 0;
+
+  for( b = 0; b < nseeds; b++ ) {
+    for( j = b; j > 0 && start[order[j-1] + 1] - start[order[j-1]] < start[b + 1] - start[b]; j-- )
+      order[j] = order[j-1];
+    order[j] = b;
+  }
+
+  for( j = 0; j < nseeds && start[order[j] + 1] > start[order[j]]; j++ ) {
+    b = order[j];
+    for( seed = 1; ; seed++ ) {
+      if( seed == 1u << 24 ) {
+        fprintf( stderr, "%s: no perfect hash found\n", path );
+        exit( 1 );
+      }
+      ok = true;
+      trial++;
+      for( k = start[b]; k < start[b + 1] && ok; k++ ) {
+        slot = SLOT(members[k], seed);
+        ok = slots[slot] == 0 && taken[slot] != trial;
+        taken[slot] = trial;
+      }
+      if( ok )
+        break;
+    }
+    seeds[b] = seed;
+    for( k = start[b]; k < start[b + 1]; k++ )
+      slots[SLOT(members[k], seed)] = members[k] + 1;
+  }
+
+#undef BUCKET
+#undef SLOT
+  free( order );
+  free( start );
+  free( members );
+  free( taken );
+}
+
+/** Check for duplicates, compile `spec` and write it to `out`. */
+static void generate( FILE* out, const spec_table_t* spec ) {
+  option_t* options = calloc( spec->count + 1, sizeof(option_t) );
+  option_table_t table;
+  unsigned* seeds;
+  unsigned* slots;
+  unsigned i, j, named, nseeds, width;
+
+  for( i = 0; i < spec->count; i++ ) {
+    for( j = 0; j < i; j++ ) {
+      if( spec->entries[i].name != NULL && spec->entries[j].name != NULL &&
+          strcmp( spec->entries[i].name, spec->entries[j].name ) == 0 )
+        fail( spec->entries[i].line, "duplicate option name `%s'", spec->entries[i].name );
+      if( spec->entries[i].abbr != '\0' && spec->entries[i].abbr == spec->entries[j].abbr )
+        fail( spec->entries[i].line, "duplicate abbreviation of `%s'",
+              spec->entries[i].name ? spec->entries[i].name : "-" );
+    }
+    if( spec->entries[i].name == NULL && spec->entries[i].abbr == '\0' )
+      fail( spec->entries[i].line, "%s", "option without name or abbreviation" );
+    memcpy( &(options[i]), &(option_t) { spec->entries[i].name, NULL, spec->entries[i].abbr, 0, NULL, NULL },
+            sizeof(option_t) );
+  }
+  if( option_table_init( &table, options ) ) {
+    fprintf( stderr, "out of memory\n" );
+    exit( 1 );
+  }
+
+  named = table.buckets[table.longest + 1];
+  nseeds = (named + 3) / 4;
+  seeds = calloc( nseeds + 1, sizeof(unsigned) );
+  slots = calloc( named + 1, sizeof(unsigned) );
+  if( named > 0 )
+    perfect_hash( &table, seeds, nseeds, slots, named );
+  width = table.columns[table.groups];
+
+  fprintf( out, "\noption_t %s[] = {\n", spec->name );
+  for( i = 0; i < spec->count; i++ ) {
+    fprintf( out, "  { " );
+    print_string( out, spec->entries[i].name );
+    fprintf( out, ", " );
+    print_string( out, spec->entries[i].desc );
+    fprintf( out, ", " );
+    print_char( out, spec->entries[i].abbr );
+    fprintf( out, ", " );
+    print_flags( out, spec->entries[i].flags );
+    fprintf( out, ", %s, %s },\n",
+             spec->entries[i].callback ? spec->entries[i].callback : "NULL",
+             spec->entries[i].data ? spec->entries[i].data : "NULL" );
+  }
+  fprintf( out, "  OPTION_EOL\n};\n\n" );
+
+  print_array( out, "unsigned", spec->name, "slots", slots, sizeof(unsigned), named );
+  print_array( out, "unsigned", spec->name, "seeds", seeds, sizeof(unsigned), nseeds );
+  print_array( out, "unsigned", spec->name, "lengths", table.lengths, sizeof(unsigned), table.count );
+  print_array( out, "unsigned", spec->name, "columns", table.columns, sizeof(unsigned), table.groups + 1 );
+  print_array( out, "unsigned char", spec->name, "lanes", table.lanes, 1, width * CHOICE_LANES );
+  print_array( out, "unsigned long long", spec->name, "sigs", table.sigs, sizeof(unsigned long long), table.count );
+  print_array( out, "unsigned", spec->name, "bylen", table.bylen, sizeof(unsigned), named );
+  print_array( out, "unsigned", spec->name, "buckets", table.buckets, sizeof(unsigned), table.longest + 2 );
+
+  fprintf( out, "\noption_table_t %s_table = {\n", spec->name );
+  fprintf( out, "  .options = %s,\n  .count = %u,\n", spec->name, table.count );
+  fprintf( out, "  .slots = %s_slots,\n  .lengths = %s_lengths,\n", spec->name, spec->name );
+  fprintf( out, "  .groups = %u,\n  .columns = %s_columns,\n  .lanes = %s_lanes,\n",
+           table.groups, spec->name, spec->name );
+  fprintf( out, "  .sigs = %s_sigs,\n  .bylen = %s_bylen,\n  .buckets = %s_buckets,\n",
+           spec->name, spec->name, spec->name );
+  fprintf( out, "  .longest = %u,\n", table.longest );
+  fprintf( out, "  .perfect = %s_seeds,\n  .seeds = %u,\n", spec->name, nseeds );
+  fprintf( out, "  .abbr = { 0," );
+  for( i = 0; i < 256; i++ )
+    if( table.abbr[i] != 0 )
+      fprintf( out, " [%u] = %u,", i, table.abbr[i] );
+  fprintf( out, " }\n};\n" );
+
+  option_table_free( &table );
+  free( options );
+  free( seeds );
+  free( slots );
+}
+
+int main( int argc, char* argv[] ) {
+  spec_table_t tables[256];
+  unsigned ntables = 0, i;
+  entry_t* entry;
+  char line[4096];
+  char* str;
+  char* abbr;
+  int number = 0;
+  FILE* in;
+
+  if( argc != 2 ) {
+    fprintf( stderr, "usage: choice-gen SPEC > SOURCE.c\n" );
+    return 2;
+  }
+  path = argv[1];
+  if( (in = fopen( path, "r" )) == NULL ) {
+    perror( path );
+    return 1;
+  }
+
+  printf( "/* generated by choice-gen from %s, do not edit */\n", path );
+  printf( "#include \"choice.h\"\n" );
+  while( fgets( line, sizeof(line), in ) != NULL ) {
+    number++;
+    line[strcspn( line, "\r\n" )] = '\0';
+    for( str = line; isspace( (unsigned char) *str ); str++ );
+
+    if( strncmp( str, "#include", 8 ) == 0 ) {
+      printf( "%s\n", str );
+    } else if( *str == '#' || *str == '\0' ) {
+      continue;
+    } else if( strncmp( str, "table", 5 ) == 0 && isspace( (unsigned char) str[5] ) ) {
+      if( ntables == sizeof(tables) / sizeof(tables[0]) )
+        fail( number, "%s", "too many tables" );
+      str += 5;
+      tables[ntables].name = field( &str, number );
+      tables[ntables].entries = NULL;
+      tables[ntables].count = 0;
+      ntables++;
+    } else if( ntables == 0 ) {
+      fail( number, "%s", "option outside of a table" );
+    } else {
+      spec_table_t* table = &(tables[ntables - 1]);
+      table->entries = realloc( table->entries, (table->count + 1) * sizeof(entry_t) );
+      entry = &(table->entries[table->count++]);
+      entry->line = number;
+      entry->name = field( &str, number );
+      abbr = field( &str, number );
+      if( abbr != NULL && strlen( abbr ) != 1 )
+        fail( number, "abbreviation `%s' is not a single character", abbr );
+      entry->abbr = (abbr != NULL) ? abbr[0] : '\0';
+      free( abbr );
+      entry->flags = field( &str, number );
+      flags_value( entry->flags, number );
+      entry->callback = field( &str, number );
+      entry->data = field( &str, number );
+      while( isspace( (unsigned char) *str ) ) str++;
+      entry->desc = (*str != '\0') ? dup( str, strlen( str ) ) : NULL;
+    }
+  }
+  fclose( in );
+
+  /* tables may refer to each other, in any order */
+  printf( "\n" );
+  for( i = 0; i < ntables; i++ )
+    printf( "extern option_t %s[];\nextern option_table_t %s_table;\n",
+            tables[i].name, tables[i].name );
+  for( i = 0; i < ntables; i++ )
+    generate( stdout, &(tables[i]) );
+  return 0;
+}
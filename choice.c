@@ -39,18 +39,179 @@
  *   [x] whistles
  *   [ ] proper error handling (return codes, callbacks)
  *   [ ] help-printing for subopts
- *   [ ] completion support
+ *   [x] completion support
  *   [ ] keep looking after first "non-option"
  *   [ ] refactor parser loop
  */
 #include "choice.h"
 #include <limits.h>
+#include <float.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
 #include <setjmp.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifndef CHOICE_NO_THREADS
+#include <pthread.h>
+#endif
+#ifdef TESTS
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef CHOICE_STATS
+/* counters and the trace hook, see `choice_stats` and `choice_trace` */
+static choice_stats_t stats;
+static choice_trace_cb trace_hook = NULL;
+static void* trace_context = NULL;
+#define CHOICE_COUNT(counter, n) ((void) __atomic_fetch_add( &(stats.counter), (n), __ATOMIC_RELAXED ))
+#define CHOICE_TRACE(event, arg, index, error) \
+  ((trace_hook != NULL) ? (trace_hook)( trace_context, (event), (arg), (index), (error) ) : (void) 0)
+#define CHOICE_CALL(callback, option, arg) choice_timed( (callback), (option), (arg) )
+
+/** Call back, and account for the time it took. */
+static int choice_timed( option_cb callback, option_t* option, const char* arg ) {
+  struct timespec start, end;
+  int error;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  error = callback( option, arg );
+  clock_gettime( CLOCK_MONOTONIC, &end );
+  CHOICE_COUNT( callbacks, 1 );
+  CHOICE_COUNT( callback_ns, (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec );
+  return error;
+}
+#else
+#define CHOICE_COUNT(counter, n) ((void) 0)
+#define CHOICE_TRACE(event, arg, index, error) ((void) (index))
+#define CHOICE_CALL(callback, option, arg) (callback)( (option), (arg) )
+#endif
+
+#ifdef TESTS
+/* count heap allocations made by the library */
+static unsigned long allocations = 0;
+#define malloc(size) (allocations++, malloc(size))
+#define calloc(count, size) (allocations++, calloc(count, size))
+#elif defined(CHOICE_STATS)
+#define malloc(size) (CHOICE_COUNT( allocations, 1 ), malloc(size))
+#define calloc(count, size) (CHOICE_COUNT( allocations, 1 ), calloc(count, size))
+#define realloc(ptr, size) (CHOICE_COUNT( allocations, 1 ), realloc(ptr, size))
+#endif
+
+#ifndef CHOICE_CELLS
+/** Called with the number of distance cells about to be evaluated. */
+#define CHOICE_CELLS(n) CHOICE_COUNT( cells, (n) )
+#endif
+
+#ifndef CHOICE_FUZZY_MAX
+/** Longest string the bounded fuzzy comparison will look at. */
+#define CHOICE_FUZZY_MAX 255
+#endif
+
+#ifndef CHOICE_CANDIDATES
+/** Most names the pruning index hands to the fuzzy comparison at once. */
+#define CHOICE_CANDIDATES 256
+#endif
+
+#ifndef CHOICE_VALUE_MAX
+/** Longest suboption parameter `choice_parse_subopt` copies to the stack. */
+#define CHOICE_VALUE_MAX 1024
+#endif
+
+#ifndef CHOICE_BATCH_THREADS
+/** Most threads `choice_batch_parse` will start. */
+#define CHOICE_BATCH_THREADS 64
+#endif
+
+#ifndef CHOICE_BATCH_CHUNK
+/** Jobs a batch worker claims at a time. */
+#define CHOICE_BATCH_CHUNK 64
+#endif
+
+#ifndef CHOICE_PARALLEL_CHUNK
+/** Arguments a thread of `choice_parse_parallel` resolves at a time. */
+#define CHOICE_PARALLEL_CHUNK 4096
+#endif
+
+#ifndef CHOICE_STREAM_MAX
+/** Longest argument a stream carries over from one chunk to the next. */
+#define CHOICE_STREAM_MAX 65536
+#endif
+
+#ifndef CHOICE_STREAM_CHUNK
+/** Bytes `choice_stream_fd` reads at a time. */
+#define CHOICE_STREAM_CHUNK 16384
+#endif
+
+#ifndef CHOICE_RESPONSE_DEPTH
+/** How deep `@file` response files may nest. */
+#define CHOICE_RESPONSE_DEPTH 16
+#endif
+
+#ifndef CHOICE_COMMAND_DEPTH
+/** How deep subcommands may nest; one more fails with `OPTION_ENOMEM`. */
+#define CHOICE_COMMAND_DEPTH 16
+#endif
+
+#ifndef CHOICE_COMPLETE_MAX
+/** Most candidates the completion server answers with. */
+#define CHOICE_COMPLETE_MAX 64
+#endif
+
+#ifndef CHOICE_COMPLETE_BUFFER
+/** Longest command line the completion server accepts. */
+#define CHOICE_COMPLETE_BUFFER 65536
+#endif
+
+#ifndef CHOICE_COMPLETE_TIMEOUT
+/** Milliseconds the completion server waits for more of a request. */
+#define CHOICE_COMPLETE_TIMEOUT 500
+#endif
+
+#ifndef CHOICE_LIST_MIN
+/** Values the first block of a `choice_list_t` holds. */
+#define CHOICE_LIST_MIN 16
+#endif
+
+#ifndef CHOICE_CACHE_KEY
+/** Longest name the resolution cache remembers. */
+#define CHOICE_CACHE_KEY 48
+#endif
+#if CHOICE_CACHE_KEY > 255
+#error "CHOICE_CACHE_KEY must fit the unsigned char length of a cache entry"
+#endif
+
+#ifndef CHOICE_CACHE_WAYS
+/** Entries per set of the resolution cache. */
+#define CHOICE_CACHE_WAYS 8
+#endif
+
+#ifndef CHOICE_SUBOPT_BATCH
+/** Suboptions split and resolved at a time. */
+#define CHOICE_SUBOPT_BATCH 256
+#endif
+
+#ifndef CHOICE_SUGGEST_MAX
+/** Most suggestions `option_table_suggest` will rank. */
+#define CHOICE_SUGGEST_MAX 8
+#endif
 
 /* MARK: option callbacks *//**
  * @name option callbacks
@@ -71,10 +232,17 @@ int option_false( option_t* option, const char* arg ) {
   return 0;
 }
 
-/** Store a `long` number in variable pointed to by `option->data` */
+/**
+ * Store a `long` number in variable pointed to by `option->data`.
+ * See `choice_decode_long` for what is accepted.
+ */
 int option_long( option_t* option, const char* arg ) {
+  long value = 0;
+  int error;
+  if( arg != NULL && (error = choice_decode_long( arg, &value )) )
+    return error;
   if( option->data != NULL )
-    *((long*) option->data) = (arg == NULL) ? 0 : atol(arg);
+    *((long*) option->data) = value;
   return 0;
 }
 
@@ -85,6 +253,144 @@ int option_str( option_t* option, const char* arg ) {
   return 0;
 }
 
+/**
+ * Make room for one more value of `size` bytes at the end of `list`.
+ * A full list doubles; in an arena, the last block is grown in place.
+ * Returns `NULL` when out of memory, leaving the list as it was.
+ */
+static void* choice_list_push( choice_list_t* list, size_t size ) {
+  choice_arena_t* arena = list->arena;
+  size_t capacity, grow;
+  char* items = list->items;
+
+  if( list->count == list->capacity ) {
+    capacity = (list->capacity > 0) ? 2 * list->capacity : CHOICE_LIST_MIN;
+    grow = (capacity - list->capacity) * size;
+    if( arena == NULL ) {
+      items = realloc( items, capacity * size );
+    } else if( items != NULL && items + list->capacity * size == arena->base + arena->used &&
+               arena->size - arena->used >= grow ) {
+      arena->used += grow;
+    } else if( (items = choice_arena_alloc( arena, capacity * size )) != NULL ) {
+      memcpy( items, list->items, list->count * size );
+    }
+    if( items == NULL )
+      return NULL;
+    list->items = items;
+    list->capacity = capacity;
+  }
+  return (char*) list->items + size * list->count++;
+}
+
+/** Append `arg` unmodified to the list pointed to by `option->data` */
+int option_strs( option_t* option, const char* arg ) {
+  const char** item;
+  if( option->data != NULL ) {
+    if( (item = choice_list_push( option->data, sizeof(*item) )) == NULL )
+      return OPTION_ENOMEM;
+    *item = arg;
+  }
+  return 0;
+}
+
+/** Append a `long` number to the list pointed to by `option->data` */
+int option_longs( option_t* option, const char* arg ) {
+  long value = 0, *item;
+  int error;
+  if( arg != NULL && (error = choice_decode_long( arg, &value )) )
+    return error;
+  if( option->data != NULL ) {
+    if( (item = choice_list_push( option->data, sizeof(*item) )) == NULL )
+      return OPTION_ENOMEM;
+    *item = value;
+  }
+  return 0;
+}
+
+/** Append `true` to the list pointed to by `option->data` */
+int option_bools( option_t* option, const char* arg ) {
+  bool* item;
+  if( option->data != NULL ) {
+    if( (item = choice_list_push( option->data, sizeof(*item) )) == NULL )
+      return OPTION_ENOMEM;
+    *item = true;
+  }
+  return 0;
+}
+
+/**
+ * Empty the list behind `option`, if it collects one, so that values
+ * replacing the old ones are not appended to them.
+ */
+static void choice_list_reset( option_t* option ) {
+  if( option->data != NULL &&
+      (option->callback == &option_strs || option->callback == &option_longs ||
+       option->callback == &option_bools || option->callback == &option_ranges) )
+    ((choice_list_t*) option->data)->count = 0;
+}
+
+/** Release the values of a heap-backed list and empty it. */
+void choice_list_free( choice_list_t* list ) {
+  if( list->arena == NULL )
+    free( list->items );
+  list->items = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+/**
+ * Store a byte count (see `choice_decode_size`) in the `unsigned long long`
+ * at `option->data`, or 0 without a parameter.
+ */
+int option_size( option_t* option, const char* arg ) {
+  unsigned long long value = 0;
+  int error;
+  if( arg != NULL && (error = choice_decode_size( arg, &value )) )
+    return error;
+  if( option->data != NULL )
+    *((unsigned long long*) option->data) = value;
+  return 0;
+}
+
+/** Store a duration in nanoseconds (see `choice_decode_duration`), or 0, at `option->data` */
+int option_duration( option_t* option, const char* arg ) {
+  unsigned long long value = 0;
+  int error;
+  if( arg != NULL && (error = choice_decode_duration( arg, &value )) )
+    return error;
+  if( option->data != NULL )
+    *((unsigned long long*) option->data) = value;
+  return 0;
+}
+
+/** Store a `double` (or 0 without a parameter) in variable pointed to by `option->data` */
+int option_double( option_t* option, const char* arg ) {
+  double value = 0;
+  int error;
+  if( arg != NULL && (error = choice_decode_double( arg, &value )) )
+    return error;
+  if( option->data != NULL )
+    *((double*) option->data) = value;
+  return 0;
+}
+
+/**
+ * Add a range list (see `choice_decode_ranges`) to the set pointed to
+ * by `option->data`. Without a parameter, there is nothing to add.
+ */
+int option_ranges( option_t* option, const char* arg ) {
+  choice_list_t scratch = CHOICE_LIST(NULL);
+  int error;
+  if( arg == NULL )
+    return 0;
+  if( option->data != NULL )
+    return choice_decode_ranges( arg, option->data );
+  /* validate all the same */
+  error = choice_decode_ranges( arg, &scratch );
+  choice_list_free( &scratch );
+  return error;
+}
+
 /** Write a line to `stdout` */
 int option_log( option_t* option, const char* arg ) {
   if( option->flags & OPTION_NODASH )
@@ -165,28 +471,352 @@ int option_help( option_t* option, const char* arg ) {
 }
 
 /**
- * Parse the suboptions in the given `arg`.
+ * Parse the suboptions in the given `arg` (none without one).
  * See `subopt_parse` for more info.
  */
 int option_subopt( option_t* option, const char* arg ) {
   char* str = (char*)arg; /* Trust me, it's going to be fine. */
-  return subopt_parse( option->data, str );
+  return (str != NULL) ? subopt_parse( option->data, str ) : 0;
+}
+
+/**
+ * Parse the suboptions in the given `arg` (none without one) against
+ * the compiled table pointed to by `option->data`.
+ * See `subopt_table_parse` for more info.
+ */
+int option_subtable( option_t* option, const char* arg ) {
+  char* str = (char*)arg;
+  return (str != NULL) ? subopt_table_parse( option->data, str ) : 0;
+}
+
+/**
+ * Mark a subcommand: `option->data` holds its options.
+ * Parsing and completion descend into it when it is named.
+ */
+int option_command( option_t* option, const char* arg ) {
+  return 0;
 }
 
 /** @} */
 
 typedef struct command_s command_t;
+typedef struct response_s response_t;
+
+/** The unread part of a mapped response file. */
+struct response_s {
+  char* pos;
+  char* end;
+};
+
+/** The last bytes of a mapped response file: its size, and the next one. */
+struct choice_mapping_s {
+  choice_mapping_t* next;
+  size_t size;
+};
 
 struct command_s {
-  option_t* options;
+  option_table_t* table;
   const char* name;
   int argc;
   char** argv;
+  char* arg;
+  unsigned depth;
+  response_t files[CHOICE_RESPONSE_DEPTH];
+  choice_mapping_t* mappings;
   jmp_buf exc;
+  const char* traced;
+  int index;
+  unsigned level;
+  option_table_t* levels[CHOICE_COMMAND_DEPTH];
 };
 
 __attribute__((noreturn))
-static void option_error( command_t* command, option_t* option, int errno, const char* arg );
+static void option_error( command_t* command, option_t* option, int code, const char* arg );
+static void response_release( choice_mapping_t* mapping );
+
+/* MARK: value decoding *//**
+ * @name value decoding
+ * The `choice_decode_*` functions take a missing value (`NULL`) for an
+ * `OPTION_EVALUE`, like any other malformed one.
+ * @{
+ */
+
+/**
+ * Decode eight decimal digits at once, the way a SIMD lane would:
+ * check all of them in one go, then pair them up to two, four and
+ * eight digits with three multiplications.
+ * Returns `false` if any of them is not a digit.
+ */
+static bool decode_digits8( const char* str, unsigned long long* value ) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  unsigned long long x;
+  memcpy( &x, str, sizeof(x) );
+  if( ((x & 0xf0f0f0f0f0f0f0f0ull) |
+       (((x + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) != 0x3333333333333333ull )
+    return false;
+  x = ((x & 0x0f0f0f0f0f0f0f0full) * 2561) >> 8;
+  x = ((x & 0x00ff00ff00ff00ffull) * 6553601) >> 16;
+  *value = ((x & 0x0000ffff0000ffffull) * 42949672960001ull) >> 32;
+  return true;
+#else
+  unsigned long long x = 0;
+  int i;
+  for( i = 0; i < 8; i++ ) {
+    if( (unsigned) (str[i] - '0') > 9 )
+      return false;
+    x = 10 * x + (unsigned) (str[i] - '0');
+  }
+  *value = x;
+  return true;
+#endif
+}
+
+/**
+ * Decode the digits of an unsigned number at `*str` into `*value` and
+ * advance `*str` past them. `0x` starts a hexadecimal and `0o` an octal
+ * number; a plain leading `0` is decimal, as it is for `atol`. Returns
+ * `OPTION_EVALUE` without digits and `OPTION_ERANGE` if the number
+ * does not fit.
+ */
+static int decode_unsigned( const char** str, unsigned long long* value ) {
+  const char* pos = *str;
+  unsigned long long result = 0, block;
+  unsigned base = 10, digit;
+  bool overflow = false;
+
+  if( pos[0] == '0' && (pos[1] == 'x' || pos[1] == 'X') && isxdigit( (unsigned char) pos[2] ) ) {
+    base = 16;
+    pos += 2;
+  } else if( pos[0] == '0' && (pos[1] == 'o' || pos[1] == 'O') && (unsigned) (pos[2] - '0') < 8 ) {
+    base = 8;
+    pos += 2;
+  } else if( (unsigned) (pos[0] - '0') > 9 ) {
+    return OPTION_EVALUE;
+  }
+
+  if( base == 10 ) {
+    /* blocks of eight digits, as long as there are eight characters left */
+    while( strnlen( pos, 8 ) == 8 && decode_digits8( pos, &block ) ) {
+      overflow |= __builtin_mul_overflow( result, 100000000ull, &result );
+      overflow |= __builtin_add_overflow( result, block, &result );
+      pos += 8;
+    }
+  }
+  for( ;; pos++ ) {
+    if( (unsigned) (*pos - '0') < 10 )
+      digit = *pos - '0';
+    else if( base == 16 && isxdigit( (unsigned char) *pos ) )
+      digit = (tolower( (unsigned char) *pos ) - 'a') + 10;
+    else
+      break;
+    if( digit >= base )
+      break;
+    overflow |= __builtin_mul_overflow( result, (unsigned long long) base, &result );
+    overflow |= __builtin_add_overflow( result, (unsigned long long) digit, &result );
+  }
+
+  *str = pos;
+  *value = result;
+  return overflow ? OPTION_ERANGE : 0;
+}
+
+/**
+ * Decode a `long`: decimal (`0755` too), hexadecimal (`0x1f`) or
+ * octal (`0o755`), with an optional sign. Unlike `atol`, trailing
+ * garbage is an `OPTION_EVALUE` and overflow an `OPTION_ERANGE`.
+ */
+int choice_decode_long( const char* str, long* value ) {
+  unsigned long long magnitude;
+  bool negative;
+  int error;
+
+  if( str == NULL )
+    return OPTION_EVALUE;
+  negative = (*str == '-');
+  if( *str == '-' || *str == '+' )
+    str++;
+  if( (error = decode_unsigned( &str, &magnitude )) )
+    return error;
+  if( *str != '\0' )
+    return OPTION_EVALUE;
+  if( magnitude > (unsigned long long) LONG_MAX + negative )
+    return OPTION_ERANGE;
+  *value = negative ? (long) (0 - magnitude) : (long) magnitude;
+  return 0;
+}
+
+/**
+ * Decode a byte count: a number as for `choice_decode_long` (but not
+ * negative), optionally followed by a decimal (`K`, `M`, `G`, `T`) or
+ * binary (`Ki`, `Mi`, `Gi`, `Ti`) multiplier.
+ */
+int choice_decode_size( const char* str, unsigned long long* value ) {
+  static const char units[] = "KMGT";
+  unsigned long long result, scale = 1;
+  const char* unit;
+  int error, i;
+
+  if( str == NULL )
+    return OPTION_EVALUE;
+  if( (error = decode_unsigned( &str, &result )) )
+    return error;
+  if( *str != '\0' ) {
+    if( (unit = strchr( units, toupper( (unsigned char) *str ) )) == NULL )
+      return OPTION_EVALUE;
+    for( i = 0; i <= unit - units; i++ )
+      scale *= (str[1] == 'i') ? 1024 : 1000;
+    str += (str[1] == 'i') ? 2 : 1;
+    if( *str != '\0' )
+      return OPTION_EVALUE;
+  }
+  if( __builtin_mul_overflow( result, scale, value ) )
+    return OPTION_ERANGE;
+  return 0;
+}
+
+/**
+ * Decode a duration into nanoseconds: a decimal number, which may have
+ * a fraction, in `ns`, `us`, `ms`, `s` (the default), `m`, `h` or `d`.
+ */
+int choice_decode_duration( const char* str, unsigned long long* nanoseconds ) {
+  static const struct {
+    const char* name;
+    unsigned long long scale;
+  } units[] = {
+    { "ns", 1ull }, { "us", 1000ull }, { "ms", 1000000ull }, { "s", 1000000000ull },
+    { "m", 60000000000ull }, { "h", 3600000000000ull }, { "d", 86400000000000ull },
+    { "", 1000000000ull }
+  };
+  const char* fraction = NULL;
+  unsigned long long whole, part = 0, scale;
+  unsigned i;
+  int error;
+
+  if( str == NULL || (unsigned) (*str - '0') > 9 )
+    return OPTION_EVALUE;
+  if( (error = decode_unsigned( &str, &whole )) )
+    return error;
+  if( *str == '.' ) {
+    fraction = ++str;
+    while( (unsigned) (*str - '0') < 10 )
+      str++;
+  }
+  for( i = 0; i < sizeof(units) / sizeof(units[0]); i++ )
+    if( strcmp( str, units[i].name ) == 0 )
+      break;
+  if( i == sizeof(units) / sizeof(units[0]) )
+    return OPTION_EVALUE;
+
+  /* digits beyond a nanosecond are dropped */
+  for( scale = units[i].scale; fraction != NULL && fraction < str; fraction++ ) {
+    scale /= 10;
+    part += (unsigned long long) (*fraction - '0') * scale;
+  }
+  if( __builtin_mul_overflow( whole, units[i].scale, nanoseconds ) ||
+      __builtin_add_overflow( *nanoseconds, part, nanoseconds ) )
+    return OPTION_ERANGE;
+  return 0;
+}
+
+/** Decode a finite `double`, as `strtod` does, but without trailing garbage. */
+int choice_decode_double( const char* str, double* value ) {
+  char* end;
+  double result;
+
+  if( str == NULL )
+    return OPTION_EVALUE;
+  result = strtod( str, &end );
+  if( end == str || *end != '\0' || isspace( (unsigned char) *str ) )
+    return OPTION_EVALUE;
+  if( !(result >= -DBL_MAX && result <= DBL_MAX) )
+    return OPTION_ERANGE;
+  *value = result;
+  return 0;
+}
+
+/**
+ * Add a list of numbers and ranges, such as `0-1023,2048`, to the
+ * interval set `ranges` (a list of `choice_range_t`). The set is kept
+ * sorted, with overlapping or adjacent intervals merged, so it stays
+ * small no matter how many numbers it covers. On error, the set is
+ * left as it was.
+ */
+int choice_decode_ranges( const char* str, choice_list_t* ranges ) {
+  size_t count = ranges->count, i, j;
+  choice_range_t* range;
+  choice_range_t item;
+  unsigned long long first, last;
+  int error;
+
+  if( str == NULL )
+    return OPTION_EVALUE;
+  do {
+    if( (error = decode_unsigned( &str, &first )) )
+      break;
+    last = first;
+    if( *str == '-' ) {
+      str++;
+      if( (error = decode_unsigned( &str, &last )) )
+        break;
+    }
+    if( (*str != ',' && *str != '\0') || first > last ) {
+      error = OPTION_EVALUE;
+      break;
+    }
+    if( last > ULONG_MAX ) {
+      error = OPTION_ERANGE;
+      break;
+    }
+    if( (range = choice_list_push( ranges, sizeof(*range) )) == NULL ) {
+      error = OPTION_ENOMEM;
+      break;
+    }
+    range->first = first;
+    range->last = last;
+  } while( *str++ == ',' );
+
+  if( error ) {
+    ranges->count = count;
+    return error;
+  }
+
+  /* insertion sort (the new ones are mostly in order), then merge */
+  range = ranges->items;
+  for( i = count; i < ranges->count; i++ ) {
+    item = range[i];
+    for( j = i; j > 0 && range[j - 1].first > item.first; j-- )
+      range[j] = range[j - 1];
+    range[j] = item;
+  }
+  for( i = 0, j = 1; j < ranges->count; j++ ) {
+    if( range[j].first <= range[i].last || range[j].first - 1 == range[i].last ) {
+      if( range[j].last > range[i].last )
+        range[i].last = range[j].last;
+    } else {
+      range[++i] = range[j];
+    }
+  }
+  if( ranges->count > 0 )
+    ranges->count = i + 1;
+  return 0;
+}
+
+/** Whether `value` is in the interval set `ranges` (see `choice_decode_ranges`). */
+bool choice_ranges_has( const choice_list_t* ranges, unsigned long value ) {
+  const choice_range_t* range = ranges->items;
+  size_t low = 0, high = ranges->count, mid;
+
+  while( low < high ) {
+    mid = low + (high - low) / 2;
+    if( range[mid].last < value )
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low < ranges->count && range[low].first <= value;
+}
+
+/** @} */
 
 /* MARK: comparators *//**
  * @name comparators
@@ -195,7 +825,10 @@ static void option_error( command_t* command, option_t* option, int errno, const
 
 static int levenshtein( const char *string1, size_t len1,
                         const char *string2, size_t len2,
-                        int swp, int sub, int ins, int del );
+                        int swp, int sub, int ins, int del, choice_arena_t* arena );
+static int levenshtein_bounded( const char *string1, size_t len1,
+                                const char *string2, size_t len2,
+                                int swp, int sub, int ins, int del, int max );
 
 /**
  * Check for exact match.
@@ -256,7 +889,9 @@ int choice_prefixcmp( const char* target, const char* str ) {
 int choice_fuzzycmp( const char* target, const char* str ) {
   int lent = strlen( target );
   int lens = strlen( str );
-  int dist = levenshtein(str, lens, target, lent, 2, 3, 1, 4);
+  int dist = (lent > CHOICE_FUZZY_MAX && lens > CHOICE_FUZZY_MAX)
+           ? levenshtein(str, lens, target, lent, 2, 3, 1, 4, NULL)
+           : levenshtein_bounded(str, lens, target, lent, 2, 3, 1, 4, INT_MAX);
   if( dist >= lent )
     return lent-dist-1;
   return dist;
@@ -266,15 +901,20 @@ int choice_fuzzycmp( const char* target, const char* str ) {
  * Damerau Levenshtein distance.
  * Computes the number of "edits" that need to be made for
  * `string1` to be the same as `string2`.
+ * The rows are taken from `arena`, if set, and handed back afterwards,
+ * else from the heap. Without room for them, the distance is `INT_MAX`.
  *
  * Adapted & extended from https://github.com/schuyler/levenshtein.
  * released by Schuyler Erle under the 2-term BSD license.
  */
 static int levenshtein( const char* str1, size_t len1,
                         const char* str2, size_t len2,
-                        int swp, int sub, int ins, int del ) {
+                        int swp, int sub, int ins, int del, choice_arena_t* arena ) {
   int *vn, *v0, *v1, *v2, *tmp;
   int i, j, next = 0;
+  size_t used = (arena != NULL) ? arena->used : 0;
+
+  CHOICE_COUNT( levenshtein, 1 );
 
   /* strip common prefixes */
   while( len1 > 0 && len2 > 0 && str1[0] == str2[0] )
@@ -284,7 +924,10 @@ static int levenshtein( const char* str1, size_t len1,
   if( !len1 ) return len2 * ins;
   if( !len2 ) return len1 * del;
 
-  vn = calloc( (len2+1)*3, sizeof(int) );
+  vn = (arena != NULL) ? choice_arena_alloc( arena, (len2+1)*3*sizeof(int) )
+                      : calloc( (len2+1)*3, sizeof(int) );
+  if( vn == NULL )
+    return INT_MAX;
   v0 = &(vn[0]);
   v1 = &(vn[len2+1]);
   v2 = &(vn[(len2+1)*2]);
@@ -295,6 +938,7 @@ static int levenshtein( const char* str1, size_t len1,
   for( i = 0; i < len1; i++ ) {
     /* set the value of the first row (deletion) */
     v2[0] = (i + 1) * del;
+    CHOICE_CELLS( len2 );
 
     for( j = 0; j < len2; j++ ) {
       next = v1[j];
@@ -324,329 +968,3953 @@ static int levenshtein( const char* str1, size_t len1,
     v2 = tmp;
   }
 
-  free(vn);
+  if( arena != NULL )
+    arena->used = used;
+  else
+    free(vn);
   return next;
 }
 
-/** @} */
-
-/* MARK: option lookup *//**
- * @name option lookup
- * @{
- */
-
 /**
- * Lookup by name, disambiguate by result distance.
- * Additionally, filter by the given flags. All given flags need to be set.
- * No flags - no filtering.
+ * Bounded Damerau Levenshtein distance.
+ * Same as `levenshtein`, but only interested in distances up to `max`.
+ * Cells whose lower bound (the length difference to and from the cell)
+ * already exceeds `max` are never evaluated, and the computation stops
+ * as soon as no cell of the last two rows can lead back under `max`.
+ * Returns the distance, or `max + 1` if it is larger than `max`.
+ *
+ * The rows live on the stack, so strings longer than `CHOICE_FUZZY_MAX`
+ * can not be compared (callers use `levenshtein` if both are); if only
+ * `string2` is too long the two strings switch roles (along with the
+ * insert and delete weights).
  */
-static option_t* option_by_name( command_t* command, int flags, const char* str ) {
-  option_t* options = command->options;
-  option_t* option = NULL;
-  int val, max = INT_MAX;
-  while( options->name != NULL || options->abbr != '\0' ) {
-    if( options->name != NULL && ((options->flags & flags) == flags) ) {
-      val = choice_fuzzycmp( options->name, str );
-      if( val >= 0 && val < INT_MAX ) {
-        if( val < max ) {
-          max = val;
-          option = options;
-        } else if( val == max ) {
-          /* ambiguous */
-          option_error( command, option, OPTION_EAMBIG, str );
-        }
+static int levenshtein_bounded( const char* str1, size_t len1,
+                                const char* str2, size_t len2,
+                                int swp, int sub, int ins, int del, int max ) {
+  int rows[3][CHOICE_FUZZY_MAX+1];
+  int *v0 = rows[0], *v1 = rows[1], *v2 = rows[2], *tmp;
+  int lo0 = 1, hi0 = 0, lo1, hi1, lo2, hi2;
+  int min1, min2;
+  int i, j, lo, hi, to, from, next, inf;
+  const char* str;
+
+  CHOICE_COUNT( levenshtein, 1 );
+  if( max < 0 )
+    return 0;
+  if( max > INT_MAX / 2 )
+    max = INT_MAX / 2;
+  inf = max + 1;
+
+  /* strip common prefixes */
+  while( len1 > 0 && len2 > 0 && str1[0] == str2[0] )
+    str1++, str2++, len1--, len2--;
+
+  /* handle degenerate cases */
+  if( !len1 ) return (len2 * ins > max) ? inf : len2 * ins;
+  if( !len2 ) return (len1 * del > max) ? inf : len1 * del;
+
+  /* the length difference alone may be too much */
+  if( (len2 > len1 ? (len2 - len1) * ins : (len1 - len2) * del) > max )
+    return inf;
+
+  if( len2 > CHOICE_FUZZY_MAX ) {
+    if( len1 > CHOICE_FUZZY_MAX )
+      return inf;
+    str = str1, str1 = str2, str2 = str;
+    i = len1, len1 = len2, len2 = i;
+    i = ins, ins = del, del = i;
+  }
+
+#define CELL(v, lo, hi, j) (((j) < (lo) || (j) > (hi)) ? inf : (v)[j])
+
+  /* initialize the column vector */
+  lo1 = 0;
+  hi1 = (len2 < max / ins) ? len2 : max / ins;
+  for( j = lo1; j <= hi1; j++ )
+    v1[j] = j * ins;
+  min1 = 0;
+
+  for( i = 0; i < len1; i++ ) {
+    /* columns that are reachable within `max` from row i + 1 */
+    lo = i + 1 - max / del;
+    hi = i + 1 + max / ins;
+    lo2 = (lo < 0) ? 0 : lo;
+    hi2 = (hi > (int) len2) ? (int) len2 : hi;
+    min2 = inf;
+    CHOICE_CELLS( (hi2 >= lo2) ? hi2 - lo2 + 1 : 0 );
+
+    for( j = lo2; j <= hi2; j++ ) {
+      to = (j > i + 1) ? (j - i - 1) * ins : (i + 1 - j) * del;
+      from = ((int) len2 - j > (int) len1 - i - 1)
+           ? ((int) len2 - j - ((int) len1 - i - 1)) * ins
+           : ((int) len1 - i - 1 - ((int) len2 - j)) * del;
+
+      if( to + from > max ) {
+        next = inf;
+      } else if( j == 0 ) {
+        /* set the value of the first row (deletion) */
+        next = (i + 1) * del;
+      } else {
+        next = CELL( v1, lo1, hi1, j-1 );
+
+        /* substitute */
+        if( str1[i] != str2[j-1] )
+          next += sub;
+        /* swap */
+        if( i && (str1[i-1] == str2[j-1]) &&
+            j > 1 && (str1[i] == str2[j-2]) &&
+            next > CELL( v0, lo0, hi0, j-2 ) + swp )
+          next = CELL( v0, lo0, hi0, j-2 ) + swp;
+        /* delete */
+        if( next > CELL( v1, lo1, hi1, j ) + del )
+          next = CELL( v1, lo1, hi1, j ) + del;
+        /* insert */
+        if( next > CELL( v2, lo2, hi2, j-1 ) + ins )
+          next = CELL( v2, lo2, hi2, j-1 ) + ins;
+
+        if( next > inf )
+          next = inf;
       }
+
+      v2[j] = next;
+      if( next < min2 )
+        min2 = next;
     }
-    options++;
+
+    /* neither this row nor a swap from the previous one can recover */
+    if( min2 > max && min1 + swp > max )
+      return inf;
+
+    /* rotate v0 << v1 << v2 */
+    tmp = v0, v0 = v1, v1 = v2, v2 = tmp;
+    lo0 = lo1, hi0 = hi1, lo1 = lo2, hi1 = hi2;
+    min1 = min2;
   }
-  return option;
+
+  next = CELL( v1, lo1, hi1, (int) len2 );
+#undef CELL
+  return next;
 }
 
-/**
- * Lookup by abbreviation.
- * Additionally, filter by the given flags. All given flags need to be set.
- * No flags - no filtering.
+/** @} */
+
+/* MARK: lane comparison *//**
+ * @name lane comparison
+ * Score one string against `CHOICE_LANES` option names at once.
+ * Names are stored column by column (all first characters, then all
+ * second characters, ...) and every lane runs the same weighted
+ * Damerau Levenshtein as `levenshtein`, in saturating 8-bit cells.
+ * @{
  */
-static option_t* option_by_abbr( const command_t* command, int flags, char c ) {
-  option_t* options = command->options;
-  while( options->name != NULL || options->abbr != '\0' ) {
-    if( options->abbr != '\0' && ((options->flags & flags) == flags) && options->abbr == c ) {
-      return options;
+
+#if defined(__AVX2__)
+typedef __m256i lane_t;
+#define LANE_WIDTH 32
+#define lane_load(p) _mm256_loadu_si256( (const __m256i*) (p) )
+#define lane_store(p, a) _mm256_storeu_si256( (__m256i*) (p), (a) )
+#define lane_set1(c) _mm256_set1_epi8( (char) (c) )
+#define lane_adds(a, b) _mm256_adds_epu8( (a), (b) )
+#define lane_min(a, b) _mm256_min_epu8( (a), (b) )
+#define lane_max(a, b) _mm256_max_epu8( (a), (b) )
+#define lane_eq(a, b) _mm256_cmpeq_epi8( (a), (b) )
+#define lane_and(a, b) _mm256_and_si256( (a), (b) )
+#define lane_andnot(a, b) _mm256_andnot_si256( (a), (b) )
+#define lane_or(a, b) _mm256_or_si256( (a), (b) )
+#define lane_all(a) (_mm256_movemask_epi8( (a) ) == -1)
+#define lane_mask(a) ((unsigned) _mm256_movemask_epi8( (a) ))
+#elif defined(__SSE2__)
+typedef __m128i lane_t;
+#define LANE_WIDTH 16
+#define lane_load(p) _mm_loadu_si128( (const __m128i*) (p) )
+#define lane_store(p, a) _mm_storeu_si128( (__m128i*) (p), (a) )
+#define lane_set1(c) _mm_set1_epi8( (char) (c) )
+#define lane_adds(a, b) _mm_adds_epu8( (a), (b) )
+#define lane_min(a, b) _mm_min_epu8( (a), (b) )
+#define lane_max(a, b) _mm_max_epu8( (a), (b) )
+#define lane_eq(a, b) _mm_cmpeq_epi8( (a), (b) )
+#define lane_and(a, b) _mm_and_si128( (a), (b) )
+#define lane_andnot(a, b) _mm_andnot_si128( (a), (b) )
+#define lane_or(a, b) _mm_or_si128( (a), (b) )
+#define lane_all(a) (_mm_movemask_epi8( (a) ) == 0xffff)
+#define lane_mask(a) ((unsigned) _mm_movemask_epi8( (a) ))
+#else
+#define LANE_WIDTH 16
+typedef struct { unsigned char c[LANE_WIDTH]; } lane_t;
+
+#define LANE_OP(name, expr) \
+  static lane_t name( lane_t a, lane_t b ) { \
+    lane_t r; int k; \
+    for( k = 0; k < LANE_WIDTH; k++ ) r.c[k] = (expr); \
+    return r; \
+  }
+LANE_OP( lane_adds, (a.c[k] + b.c[k] > 255) ? 255 : a.c[k] + b.c[k] )
+LANE_OP( lane_min, (a.c[k] < b.c[k]) ? a.c[k] : b.c[k] )
+LANE_OP( lane_max, (a.c[k] > b.c[k]) ? a.c[k] : b.c[k] )
+LANE_OP( lane_eq, (a.c[k] == b.c[k]) ? 255 : 0 )
+LANE_OP( lane_and, a.c[k] & b.c[k] )
+LANE_OP( lane_andnot, ~a.c[k] & b.c[k] )
+LANE_OP( lane_or, a.c[k] | b.c[k] )
+#undef LANE_OP
+
+static lane_t lane_load( const unsigned char* p ) {
+  lane_t r;
+  memcpy( r.c, p, LANE_WIDTH );
+  return r;
+}
+static lane_t lane_set1( unsigned char c ) {
+  lane_t r;
+  memset( r.c, c, LANE_WIDTH );
+  return r;
+}
+static bool lane_all( lane_t a ) {
+  int k;
+  for( k = 0; k < LANE_WIDTH; k++ )
+    if( a.c[k] != 255 ) return false;
+  return true;
+}
+static unsigned lane_mask( lane_t a ) {
+  unsigned mask = 0;
+  int k;
+  for( k = 0; k < LANE_WIDTH; k++ )
+    mask |= (unsigned) (a.c[k] >> 7) << k;
+  return mask;
+}
+#define lane_store(p, a) memcpy( (p), (a).c, LANE_WIDTH )
+#endif
+
+/** Saturate `n` to the 8-bit cell range. */
+#define LANE_SAT(n) ((n) > 255 ? 255 : (n))
+
+/**
+ * Weighted Damerau Levenshtein distance from `str` to each of the
+ * `CHOICE_LANES` names in `chars` (`width` columns).
+ * `lens` holds the length of each name, `stop` one more than the largest
+ * distance the caller is interested in (zero for unused lanes).
+ * Lanes are precise up to 254; once every lane has passed its `stop`,
+ * the comparison ends early and all lanes report 255.
+ */
+static void lane_distances( const unsigned char* chars, unsigned width,
+                            const unsigned char* lens, const unsigned char* stop,
+                            const char* str, size_t len,
+                            int swp, int sub, int ins, int del,
+                            unsigned char* out ) {
+  lane_t rows[3][256];
+  lane_t *v0, *v1, *v2, *tmp;
+  lane_t vswp = lane_set1( swp ), vsub = lane_set1( sub );
+  lane_t vins = lane_set1( ins ), vdel = lane_set1( del );
+  lane_t ones = lane_set1( 255 );
+  lane_t limit, cur, prev, eq, swap, next, min1, min2;
+  unsigned char cells[LANE_WIDTH];
+  const unsigned char* col;
+  unsigned v, k, c;
+  size_t i;
+  bool done;
+
+  CHOICE_COUNT( lanes, 1 );
+  for( v = 0; v < CHOICE_LANES; v += LANE_WIDTH ) {
+    col = chars + v;
+    limit = lane_load( stop + v );
+    v0 = rows[0], v1 = rows[1], v2 = rows[2];
+    done = false;
+
+    /* initialize the column vector */
+    for( c = 0; c <= width; c++ )
+      v1[c] = lane_set1( LANE_SAT( c * ins ) );
+    min1 = lane_set1( 0 );
+
+    for( i = 0; i < len && !done; i++ ) {
+      cur = lane_set1( str[i] );
+      prev = lane_set1( i ? str[i-1] : 0 );
+
+      /* set the value of the first row (deletion) */
+      v2[0] = lane_set1( LANE_SAT( (i + 1) * del ) );
+      min2 = v2[0];
+      CHOICE_CELLS( width * LANE_WIDTH );
+
+      for( c = 1; c <= width; c++ ) {
+        /* substitute */
+        eq = lane_eq( lane_load( col + (c-1) * CHOICE_LANES ), cur );
+        next = lane_adds( v1[c-1], lane_andnot( eq, vsub ) );
+        /* swap */
+        if( i && c > 1 ) {
+          swap = lane_and( lane_eq( lane_load( col + (c-1) * CHOICE_LANES ), prev ),
+                           lane_eq( lane_load( col + (c-2) * CHOICE_LANES ), cur ) );
+          next = lane_min( next, lane_or( lane_adds( v0[c-2], vswp ),
+                                          lane_andnot( swap, ones ) ) );
+        }
+        /* delete */
+        next = lane_min( next, lane_adds( v1[c], vdel ) );
+        /* insert */
+        next = lane_min( next, lane_adds( v2[c-1], vins ) );
+
+        v2[c] = next;
+        min2 = lane_min( min2, next );
+      }
+
+      /* every lane is past its stop, and no swap can bring it back */
+      done = lane_all( lane_eq( lane_max( min2, limit ), min2 ) ) &&
+             lane_all( lane_eq( lane_max( lane_adds( min1, vswp ), limit ),
+                                lane_adds( min1, vswp ) ) );
+
+      /* rotate v0 << v1 << v2 */
+      tmp = v0, v0 = v1, v1 = v2, v2 = tmp;
+      min1 = min2;
+    }
+
+    for( k = 0; k < LANE_WIDTH; k++ ) {
+      if( done ) {
+        out[v+k] = 255;
+      } else {
+        lane_store( cells, v1[lens[v+k]] );
+        out[v+k] = cells[k];
+      }
     }
-    options++;
   }
-  return NULL;
 }
 
+#undef LANE_SAT
+
 /** @} */
 
-/* MARK: argv dissection *//**
- * @name argv dissection
+/* MARK: option table *//**
+ * @name option table
  * @{
  */
 
-#ifndef _GNU_SOURCE
+/** Marks a hash slot whose name is shared by more than one option. */
+#define SLOT_DUP 0x80000000u
+
 /**
- * This is a neat function, too bad it's not available everywhere.
+ * FNV-1a, good enough for short option names, with a final mix so the
+ * low bits (the ones that pick the slot) depend on every character.
+ * A `seed` other than zero gives another, independent enough, hash
+ * (used by the perfect hash tables of `choice-gen`).
  */
-static char* strchrnul( char* str, int c ) {
-  int d = *str;
-  while( d != c && d != '\0' ) d = *(++str);
-  return str;
+unsigned choice_hash( const char* str, size_t len, unsigned seed ) {
+  unsigned hash = 2166136261u ^ (seed * 2654435761u);
+  while( len-- > 0 ) {
+    hash ^= (unsigned char) *str++;
+    hash *= 16777619u;
+  }
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  return hash;
 }
-#endif
 
 /**
- * Shift one argument from the argv list.
+ * Character signature: one bit per character (modulo 64).
+ * Different characters may share a bit, which only ever makes
+ * `option_lower_bound` more optimistic.
  */
-static char* arg_shiftstr( command_t* command ) {
-  char* str = command->argv[0];
-  command->argc -= 1;
-  command->argv = &(command->argv[1]);
-  return str;
+static unsigned long long option_signature( const char* str, size_t len ) {
+  unsigned long long sig = 0;
+  while( len-- > 0 )
+    sig |= 1ull << ((unsigned char) *str++ & 63);
+  return sig;
 }
 
 /**
- * Shift one character from the current argument.
+ * Cheap lower bound for the distance `option_by_name` computes from
+ * `str` to a name, with the weights of `choice_fuzzycmp`.
+ * Length: the difference has to be inserted (1) or deleted (4).
+ * Characters: every character of `str` missing in the name has to be
+ * substituted (3) or deleted (4), every character of the name missing
+ * in `str` inserted (1), unless a substitution already produced it.
  */
-static char arg_shiftc( command_t* command ) {
-  char c = command->argv[0][0];
-  command->argv[0] += 1;
-  return c;
+static int option_lower_bound( size_t lens, unsigned long long sigs,
+                               size_t lent, unsigned long long sigt ) {
+  int bylen = (lent > lens) ? (int) (lent - lens) : (int) (lens - lent) * 4;
+  int miss = __builtin_popcountll( sigs & ~sigt );
+  int need = __builtin_popcountll( sigt & ~sigs );
+  int bychr = 3 * miss + ((need > miss) ? need - miss : 0);
+  return (bylen > bychr) ? bylen : bychr;
 }
 
 /**
- * Shift characters from the current argument until either
- * the passed character or the end of the string is reached.
+ * Take `size` bytes from `arena`, or `NULL` if it is used up.
+ * The memory is not cleared.
  */
-static char* arg_shiftstrchr( command_t* command, char c ) {
-  char* str = command->argv[0];
-  command->argv[0] = strchrnul( str, c );
-  return str;
+void* choice_arena_alloc( choice_arena_t* arena, size_t size ) {
+  size_t used = (arena->used + 15) & ~(size_t) 15;
+  if( used > arena->size || arena->size - used < size )
+    return NULL;
+  arena->used = used + size;
+  return arena->base + used;
 }
 
-/** @} */
+/**
+ * Count `options` and work out the layout of `table`.
+ * Returns the number of bytes `option_table_build` needs.
+ */
+static size_t option_table_measure( option_table_t* table, option_t* options ) {
+  option_t* option;
+  unsigned i, len, size = 2, width = 0, cols = 0;
 
-/* MARK: option parsing *//**
- * @name option parsing
- * @{
+  memset( table, 0, sizeof(*table) );
+  table->options = options;
+
+  for( option = options; option->name != NULL || option->abbr != '\0'; option++ )
+    table->count++;
+  while( size < table->count * 2 )
+    size <<= 1;
+
+  table->mask = size - 1;
+  table->groups = (table->count + CHOICE_LANES - 1) / CHOICE_LANES;
+
+  /* a group is as wide as the longest name in its lanes */
+  for( i = 0; i < table->count; i++ ) {
+    len = (options[i].name != NULL) ? strlen( options[i].name ) : 0;
+    if( len < 256 && len > width )
+      width = len;
+    if( len > table->longest )
+      table->longest = len;
+    if( (i + 1) % CHOICE_LANES == 0 || i + 1 == table->count ) {
+      cols += width;
+      width = 0;
+    }
+  }
+
+  return table->count * sizeof(unsigned long long)
+       + (size + table->count * 2 + table->groups + 1 + table->longest + 2) * sizeof(unsigned)
+       + cols * CHOICE_LANES;
+}
+
+/**
+ * Compile the options of a measured `table` into the zeroed `mem`.
+ * Names go into an open addressing hash table, abbreviations into
+ * a direct table indexed by character. When names or abbreviations
+ * occur more than once, the first option wins the abbreviation and
+ * the name is left to the fuzzy lookup, which reports the ambiguity.
+ * Names are also transposed into lanes for `lane_distances`; names
+ * too long for the 8-bit lanes are left out and compared one by one.
+ * Finally, the pruning index sorts names by length and remembers
+ * the characters of each, see `option_table_prune`.
  */
+static void option_table_build( option_table_t* table, char* mem ) {
+  option_t* options = table->options;
+  option_t* option;
+  unsigned i, g, k, c, len, slot;
 
-static void option_error( command_t* command, option_t* option, int errno, const char* arg ) {
-  switch( errno ) {
-    case OPTION_EINVAL:
-      fprintf( stderr, "unknown option: `--%s'\n", arg );
-      break;
-    case OPTION_ENOARG:
-      fprintf( stderr, "option --%s does not take any parameters (%s)\n",
-               option->name, arg );
-      break;
-    case OPTION_EREQARG:
-      fprintf( stderr, "option --%s requires a parameter\n", option->name );
-      break;
-    case OPTION_EONCE:
-      fprintf( stderr, "option --%s may only occur once\n", option->name );
-      break;
-    case OPTION_EAMBIG:
-      fprintf( stderr, "option --%s is ambiguous (maybe --%s)\n", arg, option->name );
-      break;
+  table->sigs = (unsigned long long*) mem;
+  table->slots = (unsigned*) &(table->sigs[table->count]);
+  table->lengths = &(table->slots[table->mask + 1]);
+  table->columns = &(table->lengths[table->count]);
+  table->bylen = &(table->columns[table->groups + 1]);
+  table->buckets = &(table->bylen[table->count]);
+  table->lanes = (unsigned char*) &(table->buckets[table->longest + 2]);
+
+  for( i = 0; i < table->count; i++ ) {
+    option = &(options[i]);
+    g = i / CHOICE_LANES;
+    k = i % CHOICE_LANES;
+    if( k == 0 )
+      table->columns[g + 1] = table->columns[g];
+
+    if( option->abbr != '\0' && table->abbr[(unsigned char) option->abbr] == 0 )
+      table->abbr[(unsigned char) option->abbr] = i + 1;
+    if( option->name == NULL )
+      continue;
+
+    len = table->lengths[i] = strlen( option->name );
+    table->sigs[i] = option_signature( option->name, len );
+    table->buckets[len + 1]++;
+    if( len < 256 ) {
+      if( table->columns[g + 1] < table->columns[g] + len )
+        table->columns[g + 1] = table->columns[g] + len;
+      for( c = 0; c < len; c++ )
+        table->lanes[(table->columns[g] + c) * CHOICE_LANES + k] = option->name[c];
+    }
+
+    slot = choice_hash( option->name, len, 0 ) & table->mask;
+    while( table->slots[slot] != 0 ) {
+      if( strcmp( options[(table->slots[slot] & ~SLOT_DUP) - 1].name, option->name ) == 0 )
+        break;
+      slot = (slot + 1) & table->mask;
+    }
+    if( table->slots[slot] != 0 )
+      table->slots[slot] |= SLOT_DUP;
+    else
+      table->slots[slot] = i + 1;
   }
-  longjmp( command->exc, errno );
+
+  /* counting sort by name length, `buckets[len]` is where `len` starts */
+  for( len = 1; len <= table->longest + 1; len++ )
+    table->buckets[len] += table->buckets[len - 1];
+  for( i = 0; i < table->count; i++ )
+    if( options[i].name != NULL )
+      table->bylen[table->buckets[table->lengths[i]]++] = i;
+  for( len = table->longest + 1; len > 0; len-- )
+    table->buckets[len] = table->buckets[len - 1];
+  table->buckets[0] = 0;
 }
 
-static int option_callback( option_t* option, const char* arg ) {
-  if( arg != NULL && *arg == '\0' )
-    arg = NULL;
+/** Does `options` have a subcommand without options of its own? */
+static bool option_table_invalid( const option_t* options ) {
+  for( ; options->name != NULL || options->abbr != '\0'; options++ )
+    if( options->callback == &option_command && options->data == NULL )
+      return true;
+  return false;
+}
 
-  if( arg == NULL && (option->flags & OPTION_REQARG) )
-    return OPTION_EREQARG;
-  else if( arg != NULL && !(option->flags & OPTION_ARG) )
-    return OPTION_ENOARG;
+/**
+ * Compile `options` into `table`, see `option_table_build`.
+ * Fails with `OPTION_EINVAL` for a subcommand without options.
+ */
+int option_table_init( option_table_t* table, option_t* options ) {
+  char* mem;
+
+  if( option_table_invalid( options ) )
+    return OPTION_EINVAL;
+  mem = calloc( 1, option_table_measure( table, options ) );
+  if( mem == NULL )
+    return OPTION_ENOMEM;
+  option_table_build( table, mem );
+  return 0;
+}
 
-  if( option->callback )
-    return (option->callback)( option, arg );
+/**
+ * Compile `options` into `table`, taking the memory from `arena`
+ * instead of the heap. Fails with `OPTION_ENOMEM` if the arena is too
+ * small, see `option_table_size`, and like `option_table_init` for a
+ * subcommand without options.
+ */
+int option_table_init_arena( option_table_t* table, option_t* options, choice_arena_t* arena ) {
+  size_t size;
+  char* mem;
 
+  if( option_table_invalid( options ) )
+    return OPTION_EINVAL;
+  size = option_table_measure( table, options );
+  mem = choice_arena_alloc( arena, size );
+  if( mem == NULL )
+    return OPTION_ENOMEM;
+  memset( mem, 0, size );
+  option_table_build( table, mem );
+  table->arena = arena;
   return 0;
 }
 
-int option_parse( option_t* options, int argc, char* argv[] ) {
-  command_t command = { options, argv[0], argc - 1, &(argv[1]) };
-  option_t* option = NULL;
+/** Number of arena bytes `option_table_init_arena` takes for `options`. */
+size_t option_table_size( option_t* options ) {
+  option_table_t table;
+  return option_table_measure( &table, options ) + 15;
+}
 
-#define S_ANY 0
-#define S_ARG 1
-#define S_ABBR 2
-#define S_NAME 3
-#define S_DONE 4
-#define ARG (command.argv[0])
+/**
+ * Unmap the `@file`s that parses with `table` expanded. Callbacks must
+ * no longer hold on to the arguments they read from them.
+ */
+void option_table_release( option_table_t* table ) {
+  response_release( table->mappings );
+  table->mappings = NULL;
+}
 
-  char* name;
-  char abbr;
-  char* arg;
-  int state = S_ANY, error = 0;
+/**
+ * Release the memory held by `table`, but not the options themselves.
+ * Arena memory is left to the owner of the arena. A table generated by
+ * `choice-gen` is static, so only what parsing added to it (mapped
+ * files, the tables of subcommands) is released, and it stays usable.
+ */
+void option_table_free( option_table_t* table ) {
+  unsigned i;
 
-  if( (error = setjmp(command.exc)) ) {
-    return error;
+  option_table_release( table );
+  if( table->arena == NULL && table->children != NULL ) {
+    for( i = 0; i < table->count; i++ ) {
+      if( table->children[i] != NULL ) {
+        option_table_free( table->children[i] );
+        free( table->children[i] );
+      }
+    }
+    free( table->children );
   }
+  table->children = NULL;
+  if( table->perfect != NULL )
+    return;
+  if( table->arena == NULL )
+    free( table->sigs );
+  table->sigs = NULL;
+  table->slots = NULL;
+}
 
-  while( command.argc > 0 ) {
+/**
+ * The table of the subcommand `option` of `table`, compiled on first use
+ * (in the arena of `table`, if it has one) and kept until `table` is
+ * freed. Returns `NULL` when out of memory, or if the subcommand has no
+ * valid options (see `option_table_init`).
+ */
+static option_table_t* option_table_child( option_table_t* table, option_t* option ) {
+  option_table_t** children = __atomic_load_n( &table->children, __ATOMIC_ACQUIRE );
+  option_table_t** expected = NULL;
+  option_table_t* none = NULL;
+  option_table_t* child;
+  size_t size = table->count * sizeof(option_table_t*);
+  unsigned index = option - table->options;
 
-    switch( state ) {
-      case S_ANY:
-        if( ARG[0] == '-' ) {
-          if( option ) {
-            option_callback( option, NULL );
-            option = NULL;
-          }
-          if( ARG[1] == '-' ) {
-            ARG += 2;
-            state = S_NAME;
-          } else if( ARG[1] != '\0' ) {
-            ARG += 1;
-            state = S_ABBR;
-          }
-          break;
-        } else {
-          /* TODO: try to find a NODASH option */
-        }
-      case S_ARG:
-        if( option == NULL ) {
-          state = S_DONE;
-        } else {
-          arg = arg_shiftstr( &command );
-          option_callback( option, arg );
-          option = NULL;
-          state = S_ANY;
-        }
-        break;
-      case S_ABBR:
-        abbr = arg_shiftc( &command );
-        if( abbr == '\0' ) {
-          /* end of abbreviated option list */
-          arg_shiftstr( &command );
-          state = S_ANY;
-        } else {
-          /* todo, only match with OPTION_NODASH not set */
-          option = option_by_abbr( &command, 0, abbr );
-          if( option == NULL ) {
-            /* unknown option */
-            fprintf( stderr, "unknown option -%c!\n", abbr );
-            return OPTION_EINVAL;
-          }
-          if( option->flags & OPTION_ARG ) {
-            arg = arg_shiftstr( &command );
-            if( arg[0] != '\0' ) {
-              option_callback( option, arg );
-              option = NULL;
-              state = S_ANY;
-            } else {
-              state = (option->flags & OPTION_REQARG) ? S_ARG : S_ANY;
-            }
-          } else {
-            option_callback( option, NULL );
-            option = NULL;
-            state = S_ABBR;
-          }
-        }
-        break;
-      case S_NAME:
-        name = arg_shiftstrchr( &command, '=' );
-        arg  = arg_shiftstr( &command );
-        if( arg[0] == '=' ) *arg++ = '\0';
-        if( *name == '\0' ) {
-          /* "--" */
-          arg_shiftstr( &command );
-          state = S_DONE;
-        } else {
-          /* todo, only match with OPTION_NODASH not set */
-          option = option_by_name( &command, 0, name );
-          if( option == NULL ) {
-            /* unknown option */
-            fprintf( stderr, "unknown option --%s!\n", name );
-            return OPTION_EINVAL;
-          }
-          if( option->flags & OPTION_ARG ) {
-            if( arg[0] != '\0' ) {
-              option_callback( option, arg );
-              option = NULL;
-              state = S_ANY;
-            } else {
-              state = (option->flags & OPTION_REQARG) ? S_ARG : S_ANY;
-            }
-          } else if( arg[0] != '\0' ) {
-            /* does not take args */
-            fprintf( stderr, "option --%s does not take parameters (%s)!\n", option->name, arg );
-            return OPTION_ENOARG;
-          } else {
-            option_callback( option, NULL );
-            option = NULL;
-            state = S_ANY;
-          }
-        }
-        break;
-      case S_DONE:
-        return 0;
+  if( option->data == NULL )
+    return NULL;
+  if( children == NULL ) {
+    if( table->arena != NULL ) {
+      if( (children = choice_arena_alloc( table->arena, size )) == NULL )
+        return NULL;
+      memset( children, 0, size );
+    } else if( (children = calloc( table->count, sizeof(option_table_t*) )) == NULL ) {
+      return NULL;
+    }
+    /* another thread may have been quicker */
+    if( !__atomic_compare_exchange_n( &table->children, &expected, children, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+      if( table->arena == NULL )
+        free( children );
+      children = expected;
     }
   }
+  if( (child = __atomic_load_n( &children[index], __ATOMIC_ACQUIRE )) != NULL )
+    return child;
 
-#undef S_ANY
-#undef S_ARG
-#undef S_ABBR
-#undef S_NAME
-#undef S_DONE
-#undef ARG
-  return 0;
+  if( table->arena != NULL ) {
+    if( (child = choice_arena_alloc( table->arena, sizeof(*child) )) == NULL ||
+        option_table_init_arena( child, option->data, table->arena ) != 0 )
+      return NULL;
+  } else {
+    if( (child = malloc( sizeof(*child) )) == NULL )
+      return NULL;
+    if( option_table_init( child, option->data ) != 0 ) {
+      free( child );
+      return NULL;
+    }
+  }
+
+  if( !__atomic_compare_exchange_n( &children[index], &none, child, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ) ) {
+    if( table->arena == NULL ) {
+      option_table_free( child );
+      free( child );
+    }
+    child = none;
+  }
+  return child;
 }
 
-int subopt_parse( option_t* options, char* argv ) {
-  option_t* option = NULL;
-  command_t command = { options, NULL, 1, &argv };
+/**
+ * Find the option named exactly `len` characters of `str`.
+ * Names shared by several options are never found here.
+ */
+static option_t* option_table_find( const option_table_t* table, const char* str, size_t len ) {
+  unsigned slot = choice_hash( str, len, 0 ) & table->mask;
+  unsigned index;
+  option_t* option;
 
-  char* name;
-  char* arg;
+  /* generated tables hash every name to a slot of its own */
+  if( table->perfect != NULL ) {
+    if( table->seeds == 0 || table->buckets[table->longest + 1] == 0 )
+      return NULL;
+    slot = choice_hash( str, len, table->perfect[choice_hash( str, len, 0 ) % table->seeds] )
+         % table->buckets[table->longest + 1];
+    option = &(table->options[table->slots[slot] - 1]);
+    if( strncmp( option->name, str, len ) == 0 && option->name[len] == '\0' )
+      return option;
+    return NULL;
+  }
+
+  while( (index = table->slots[slot]) != 0 ) {
+    option = &(table->options[(index & ~SLOT_DUP) - 1]);
+    if( strncmp( option->name, str, len ) == 0 && option->name[len] == '\0' )
+      return (index & SLOT_DUP) ? NULL : option;
+    slot = (slot + 1) & table->mask;
+  }
+  return NULL;
+}
 
-  while( *argv != '\0' ) {
-    name = argv;
-    argv = strchrnul( argv, ',' );
-    if( argv[0] == ',' ) *argv++ = '\0';
-    arg  = strchrnul( name, '=' );
-    if( arg[0] == '=' ) *arg++ = '\0';
+#undef SLOT_DUP
 
-    option = option_by_name( &command, OPTION_NODASH, name );
-    if( option == NULL ) {
-      /* unknown option */
-      return 1;
+/**
+ * Collect the options whose names could be within `choice_fuzzycmp`
+ * distance of `str` (less than the length of the name), in option order.
+ * Only the length buckets that can match are visited; names in them are
+ * checked against their signature. Returns the number of candidates, or
+ * `max + 1` if there are more than `max` and the caller has to look at
+ * every option instead.
+ */
+static unsigned option_table_prune( const option_table_t* table, const char* str, size_t len,
+                                    unsigned* out, unsigned max ) {
+  unsigned long long sig = option_signature( str, len );
+  unsigned lent, n = 0, b, i, j;
+
+  /* shorter names have to be deleted down to: 4 * (len - lent) < lent */
+  for( lent = (4 * len + 5) / 5; lent <= table->longest; lent++ ) {
+    for( b = table->buckets[lent]; b < table->buckets[lent + 1]; b++ ) {
+      if( option_lower_bound( len, sig, lent, table->sigs[table->bylen[b]] ) >= (int) lent )
+        continue;
+      if( n == max )
+        return max + 1;
+      out[n++] = table->bylen[b];
     }
-    if( option->flags & OPTION_ARG ) {
-      if( arg[0] != '\0' ) {
-        (option->callback)( option, arg );
-        option = NULL;
-      } else {
-        /* requires arg */
-        return 1;
+  }
+
+  /* back to option order; candidates are few, and qsort may allocate */
+  for( i = 1; i < n; i++ ) {
+    b = out[i];
+    for( j = i; j > 0 && out[j-1] > b; j-- )
+      out[j] = out[j-1];
+    out[j] = b;
+  }
+  return n;
+}
+
+/**
+ * Suggest up to `k` (at most `CHOICE_SUGGEST_MAX`) options for the
+ * unknown name `str`, best first, to fill in a "did you mean".
+ * Suggestions are more lenient than `option_by_name`, which already
+ * took every name closer than its length: a name qualifies if the
+ * distance is no more than one and a half times the longer of the two.
+ * Returns the number of options stored in `out`.
+ */
+int option_table_suggest( const option_table_t* table, const char* str,
+                          option_t* out[], int k ) {
+  size_t len = strlen( str );
+  unsigned long long sig = option_signature( str, len );
+  int dist[CHOICE_SUGGEST_MAX];
+  unsigned lent, b, i;
+  int n = 0, j, val, bound, limit;
+
+  if( k > CHOICE_SUGGEST_MAX )
+    k = CHOICE_SUGGEST_MAX;
+  if( k <= 0 )
+    return 0;
+
+  /* deleting a character costs 4, so shorter names are out of reach soon */
+  for( lent = (5 * len + 7) / 8; lent <= table->longest; lent++ ) {
+    limit = 3 * ((lent > len) ? lent : len) / 2;
+    for( b = table->buckets[lent]; b < table->buckets[lent + 1]; b++ ) {
+      i = table->bylen[b];
+      bound = (n == k && dist[n-1] - 1 < limit) ? dist[n-1] - 1 : limit;
+      if( lent == 0 || option_lower_bound( len, sig, lent, table->sigs[i] ) > bound )
+        continue;
+      if( lent > CHOICE_FUZZY_MAX && len > CHOICE_FUZZY_MAX )
+        val = levenshtein( str, len, table->options[i].name, lent, 2, 3, 1, 4, table->arena );
+      else
+        val = levenshtein_bounded( str, len, table->options[i].name, lent, 2, 3, 1, 4, bound );
+      if( val > bound )
+        continue;
+
+      /* insert, keeping ties in option order */
+      for( j = (n < k) ? n++ : n - 1;
+           j > 0 && (dist[j-1] > val || (dist[j-1] == val && out[j-1] > &(table->options[i])));
+           j-- ) {
+        dist[j] = dist[j-1];
+        out[j] = out[j-1];
       }
-    } else if( arg[0] != '\0' ) {
-      /* does not take args */
-      return 1;
-    } else {
-      (option->callback)( option, NULL );
-      option = NULL;
+      dist[j] = val;
+      out[j] = &(table->options[i]);
     }
   }
-  return 0;
+  return n;
 }
 
 /** @} */
 
-#ifdef TESTS
-void distance_demo( int (*callback)( const char*, const char* ) ) {
-  int i;
-  struct {
-    const char* a;
-    const char* b;
-    int d;
-  } lev[] = {
-    { "test", "test", 0 },
+/* MARK: resolution cache *//**
+ * @name resolution cache
+ * Remembers what misspelled names resolved to (an option, an ambiguity
+ * or nothing), so that the same typo only pays for one fuzzy lookup.
+ * Entries are kept in sets of `CHOICE_CACHE_WAYS`, and a CLOCK hand per
+ * set picks the entry to replace: the first one that has not been hit
+ * since the hand last passed it. Lookups share a read lock; only
+ * inserting a new entry takes the write lock.
+ * @{
+ */
+
+typedef struct cache_entry_s {
+  bool used;
+  unsigned char ref;
+  unsigned char len;
+  int flags;
+  unsigned hash;
+  unsigned option;
+  unsigned ambig;
+  char key[CHOICE_CACHE_KEY];
+} cache_entry_t;
+
+struct choice_cache_s {
+#ifndef CHOICE_NO_THREADS
+  pthread_rwlock_t lock;
+#endif
+  const option_table_t* table;
+  unsigned sets;
+  unsigned* hands;
+  cache_entry_t* entries;
+  unsigned long long hits;
+  unsigned long long misses;
+};
+
+#ifndef CHOICE_NO_THREADS
+#define cache_rdlock(cache) pthread_rwlock_rdlock( &(cache)->lock )
+#define cache_wrlock(cache) pthread_rwlock_wrlock( &(cache)->lock )
+#define cache_unlock(cache) pthread_rwlock_unlock( &(cache)->lock )
+#else
+#define cache_rdlock(cache) ((void) 0)
+#define cache_wrlock(cache) ((void) 0)
+#define cache_unlock(cache) ((void) 0)
+#endif
+
+/**
+ * Make a cache of (at least) `entries` resolutions, or `NULL` when out of
+ * memory. Attach it to a table with `option_table_cache`. There are at
+ * most as many entries as the largest power of two an `unsigned` holds.
+ */
+choice_cache_t* choice_cache_new( unsigned entries ) {
+  choice_cache_t* cache = calloc( 1, sizeof(*cache) );
+  unsigned sets = 1;
+
+  while( sets * CHOICE_CACHE_WAYS < entries && sets <= UINT_MAX / 2 / CHOICE_CACHE_WAYS )
+    sets <<= 1;
+  if( cache == NULL )
+    return NULL;
+  cache->sets = sets;
+  cache->hands = calloc( sets, sizeof(unsigned) );
+  cache->entries = calloc( sets * CHOICE_CACHE_WAYS, sizeof(cache_entry_t) );
+  if( cache->hands == NULL || cache->entries == NULL ) {
+    free( cache->hands );
+    free( cache->entries );
+    free( cache );
+    return NULL;
+  }
+#ifndef CHOICE_NO_THREADS
+  pthread_rwlock_init( &cache->lock, NULL );
+#endif
+  return cache;
+}
+
+void choice_cache_free( choice_cache_t* cache ) {
+  if( cache == NULL )
+    return;
+#ifndef CHOICE_NO_THREADS
+  pthread_rwlock_destroy( &cache->lock );
+#endif
+  free( cache->hands );
+  free( cache->entries );
+  free( cache );
+}
+
+/** Forget everything; needed whenever the options of the table change. */
+void choice_cache_clear( choice_cache_t* cache ) {
+  cache_wrlock( cache );
+  memset( cache->entries, 0, cache->sets * CHOICE_CACHE_WAYS * sizeof(cache_entry_t) );
+  memset( cache->hands, 0, cache->sets * sizeof(unsigned) );
+  cache_unlock( cache );
+}
+
+/** How many lookups the cache has answered, and how many it could not. */
+void choice_cache_stats( choice_cache_t* cache, unsigned long long* hits, unsigned long long* misses ) {
+  if( hits != NULL )
+    *hits = __atomic_load_n( &cache->hits, __ATOMIC_RELAXED );
+  if( misses != NULL )
+    *misses = __atomic_load_n( &cache->misses, __ATOMIC_RELAXED );
+}
+
+/**
+ * Have lookups in `table` go through `cache` (`NULL` for none). The
+ * cache is cleared, and serves this table only. It stays the caller's:
+ * `option_table_free` leaves it alone, `option_table_init` detaches it.
+ */
+void option_table_cache( option_table_t* table, choice_cache_t* cache ) {
+  table->cache = cache;
+  if( cache != NULL ) {
+    choice_cache_clear( cache );
+    cache->table = table;
+  }
+}
+
+/** Look up a resolution; returns `false` if there is none. */
+static bool cache_get( const option_table_t* table, int flags, const char* str, size_t len,
+                       option_t** option, option_t** ambig ) {
+  choice_cache_t* cache = table->cache;
+  cache_entry_t* entry;
+  unsigned hash, k;
+  bool found = false;
+
+  if( cache->table != table || len > CHOICE_CACHE_KEY )
+    return false;
+  hash = choice_hash( str, len, flags );
+  entry = &(cache->entries[(hash & (cache->sets - 1)) * CHOICE_CACHE_WAYS]);
+
+  cache_rdlock( cache );
+  for( k = 0; k < CHOICE_CACHE_WAYS && !found; k++, entry++ ) {
+    if( entry->used && entry->hash == hash && entry->len == len &&
+        entry->flags == flags && memcmp( entry->key, str, len ) == 0 ) {
+      __atomic_store_n( &entry->ref, 1, __ATOMIC_RELAXED );
+      *option = entry->option ? &(table->options[entry->option - 1]) : NULL;
+      *ambig = entry->ambig ? &(table->options[entry->ambig - 1]) : NULL;
+      found = true;
+    }
+  }
+  cache_unlock( cache );
+
+  __atomic_fetch_add( found ? &cache->hits : &cache->misses, 1, __ATOMIC_RELAXED );
+  return found;
+}
+
+/** Remember a resolution, replacing what the CLOCK hand of its set points at. */
+static void cache_put( const option_table_t* table, int flags, const char* str, size_t len,
+                       option_t* option, option_t* ambig ) {
+  choice_cache_t* cache = table->cache;
+  cache_entry_t* set;
+  cache_entry_t* entry;
+  unsigned hash, index, k;
+
+  if( cache->table != table || len > CHOICE_CACHE_KEY )
+    return;
+  hash = choice_hash( str, len, flags );
+  index = hash & (cache->sets - 1);
+  set = &(cache->entries[index * CHOICE_CACHE_WAYS]);
+
+  cache_wrlock( cache );
+  for( k = 0; k < CHOICE_CACHE_WAYS; k++ ) {
+    entry = &(set[k]);
+    if( entry->used && entry->hash == hash && entry->len == len &&
+        entry->flags == flags && memcmp( entry->key, str, len ) == 0 )
+      break;
+  }
+  if( k == CHOICE_CACHE_WAYS ) {
+    /* second chance for the entries hit since the last sweep */
+    for( ;; ) {
+      entry = &(set[cache->hands[index]]);
+      cache->hands[index] = (cache->hands[index] + 1) % CHOICE_CACHE_WAYS;
+      if( !entry->used || !__atomic_load_n( &entry->ref, __ATOMIC_RELAXED ) )
+        break;
+      __atomic_store_n( &entry->ref, 0, __ATOMIC_RELAXED );
+    }
+    entry->used = true;
+    entry->ref = 0;
+    entry->hash = hash;
+    entry->len = len;
+    entry->flags = flags;
+    memcpy( entry->key, str, len );
+    entry->option = option ? option - table->options + 1 : 0;
+    entry->ambig = ambig ? ambig - table->options + 1 : 0;
+  }
+  cache_unlock( cache );
+}
+
+/** @} */
+
+/* MARK: option lookup *//**
+ * @name option lookup
+ * @{
+ */
+
+/**
+ * Fuzzy part of `option_lookup`: the candidates are first pruned by
+ * `option_table_prune`, and the rest are scored one lane group at a
+ * time. Matches are still accepted in the order of the options, so the
+ * first tie with the best match so far is reported as ambiguous, just
+ * like comparing one by one would.
+ */
+static option_t* option_fuzzy( const option_table_t* table, int flags,
+                               const char* str, size_t len, option_t** ambig ) {
+  unsigned long long sig = option_signature( str, len );
+  option_t* option = NULL;
+  option_t* candidate;
+  unsigned cand[CHOICE_CANDIDATES];
+  unsigned char lens[CHOICE_LANES], stop[CHOICE_LANES], dist[CHOICE_LANES];
+  int lb[CHOICE_LANES];
+  bool live[CHOICE_LANES];
+  unsigned g, k, i, lent, n, c = 0;
+  bool any;
+  int val, bound, max = INT_MAX;
+
+  CHOICE_COUNT( fuzzy, 1 );
+  n = option_table_prune( table, str, len, cand, CHOICE_CANDIDATES );
+  for( g = 0; g < table->groups; g++ ) {
+    memset( live, n > CHOICE_CANDIDATES, sizeof(live) );
+    if( n <= CHOICE_CANDIDATES ) {
+      /* skip ahead to the next group that has candidates */
+      if( c == n )
+        break;
+      g = cand[c] / CHOICE_LANES;
+      for( ; c < n && cand[c] / CHOICE_LANES == g; c++ )
+        live[cand[c] % CHOICE_LANES] = true;
+    }
+
+    /* lanes only need to be precise up to the best match so far */
+    any = false;
+    for( k = 0; k < CHOICE_LANES; k++ ) {
+      i = g * CHOICE_LANES + k;
+      lent = (i < table->count) ? table->lengths[i] : 0;
+      lb[k] = (live[k] && lent > 0) ? option_lower_bound( len, sig, lent, table->sigs[i] ) : INT_MAX;
+      bound = (max < (int) lent - 1) ? max : (int) lent - 1;
+      lens[k] = (lent < 256) ? lent : 0;
+      stop[k] = (lb[k] <= bound && lent < 256 &&
+                 (table->options[i].flags & flags) == flags)
+              ? bound + 1 : 0;
+      any = any || stop[k] != 0;
+    }
+    if( any )
+      lane_distances( &(table->lanes[table->columns[g] * CHOICE_LANES]),
+                      table->columns[g + 1] - table->columns[g],
+                      lens, stop, str, len, 2, 3, 1, 4, dist );
+    else
+      memset( dist, 255, sizeof(dist) );
+
+    for( k = 0; k < CHOICE_LANES && g * CHOICE_LANES + k < table->count; k++ ) {
+      i = g * CHOICE_LANES + k;
+      candidate = &(table->options[i]);
+      if( candidate->name == NULL || ((candidate->flags & flags) != flags) )
+        continue;
+
+      /* same weights and cut-off as `choice_fuzzycmp`, but never look
+       * further than the best match so far */
+      lent = table->lengths[i];
+      bound = (max < (int) lent - 1) ? max : (int) lent - 1;
+      if( bound < 0 || lb[k] > bound )
+        continue;
+      if( lent < 256 )
+        val = dist[k];
+      else if( lent > CHOICE_FUZZY_MAX && len > CHOICE_FUZZY_MAX )
+        val = levenshtein( str, len, candidate->name, lent, 2, 3, 1, 4, table->arena );
+      else
+        val = levenshtein_bounded( str, len, candidate->name, lent, 2, 3, 1, 4, bound );
+
+      if( val <= bound ) {
+        if( val < max ) {
+          max = val;
+          option = candidate;
+        } else if( val == max ) {
+          /* ambiguous */
+          CHOICE_COUNT( ambiguous, 1 );
+          *ambig = option;
+          return NULL;
+        }
+      }
+    }
+  }
+  return option;
+}
+
+/**
+ * Lookup by name, disambiguate by result distance.
+ * Exact matches are served by the hash table, everything else by the
+ * table's cache (if it has one) or `option_fuzzy`.
+ * Additionally, filter by the given flags. All given flags need to be set.
+ * No flags - no filtering.
+ * On ambiguity, `NULL` is returned and `*ambig` is the best match so far.
+ */
+static option_t* option_lookup( const option_table_t* table, int flags,
+                                const char* str, size_t len, option_t** ambig ) {
+  option_t* option = option_table_find( table, str, len );
+
+  *ambig = NULL;
+  if( option != NULL && ((option->flags & flags) == flags) ) {
+    CHOICE_COUNT( exact, 1 );
+    return option;
+  }
+  if( table->cache != NULL && cache_get( table, flags, str, len, &option, ambig ) )
+    return option;
+  option = option_fuzzy( table, flags, str, len, ambig );
+  if( table->cache != NULL )
+    cache_put( table, flags, str, len, option, *ambig );
+  return option;
+}
+
+/**
+ * Same as `option_lookup`, but leave the parse if `str` is ambiguous.
+ * Inside a subcommand, the options of the commands around it count,
+ * too: an exact name on the nearest level that has it comes first, then
+ * the nearest level with a fuzzy match (like abbreviations, the
+ * subcommand's own options shadow those around it).
+ */
+static option_t* option_by_name( command_t* command, int flags, const char* str ) {
+  size_t len = strlen( str );
+  option_t* ambig = NULL;
+  option_t* option = NULL;
+  int level;
+
+  for( level = command->level; level >= 0 && option == NULL; level-- ) {
+    option = option_table_find( command->levels[level], str, len );
+    if( option != NULL && ((option->flags & flags) != flags) )
+      option = NULL;
+  }
+  for( level = command->level; level >= 0 && option == NULL && ambig == NULL; level-- )
+    option = option_lookup( command->levels[level], flags, str, len, &ambig );
+  if( ambig != NULL )
+    option_error( command, ambig, OPTION_EAMBIG, str );
+  return option;
+}
+
+/**
+ * Lookup of an argument without dashes, which may just as well be a
+ * positional argument: so no fuzzy matching, but the exact name on the
+ * nearest level that has it, or else a unique prefix on the current
+ * one. Commands are only looked up on the current level, so that a
+ * positional argument that looks like a command is not taken for one.
+ */
+static option_t* option_by_word( command_t* command, const char* str ) {
+  const option_table_t* table = command->table;
+  size_t len = strlen( str );
+  option_t* option;
+  option_t* found = NULL;
+  unsigned i;
+  int level;
+
+  for( level = command->level; level >= 0; level-- ) {
+    option = option_table_find( command->levels[level], str, len );
+    if( option != NULL && (option->flags & OPTION_NODASH) &&
+        (level == command->level || option->callback != &option_command) )
+      return option;
+  }
+  for( i = 0; len > 0 && i < table->count; i++ ) {
+    option = &(table->options[i]);
+    if( option->name != NULL && (option->flags & OPTION_NODASH) &&
+        strncmp( option->name, str, len ) == 0 ) {
+      if( found != NULL )
+        return NULL;
+      found = option;
+    }
+  }
+  return found;
+}
+
+/**
+ * Lookup by abbreviation, nearest level first.
+ * Additionally, filter by the given flags. All given flags need to be set.
+ * No flags - no filtering.
+ */
+static option_t* option_by_abbr( const command_t* command, int flags, char c ) {
+  const option_table_t* table;
+  unsigned index;
+  option_t* options;
+  int level;
+
+  CHOICE_COUNT( abbr, 1 );
+  for( level = command->level; level >= 0; level-- ) {
+    table = command->levels[level];
+    if( (index = table->abbr[(unsigned char) c]) == 0 )
+      continue;
+
+    options = &(table->options[index - 1]);
+    while( options->name != NULL || options->abbr != '\0' ) {
+      if( options->abbr == c && ((options->flags & flags) == flags) ) {
+        return options;
+      }
+      options++;
+    }
+  }
+  return NULL;
+}
+
+/** @} */
+
+/* MARK: argv dissection *//**
+ * @name argv dissection
+ * @{
+ */
+
+#ifndef _GNU_SOURCE
+/**
+ * This is a neat function, too bad it's not available everywhere.
+ */
+static char* strchrnul( char* str, int c ) {
+  int d = *str;
+  while( d != c && d != '\0' ) d = *(++str);
+  return str;
+}
+#endif
+
+/**
+ * Map the response file `path` (private and writable, so it can be
+ * tokenized in place) and push it onto the files of `command`.
+ * The mapping is one byte longer than the file, so the last argument
+ * can be terminated, too, and ends in a `choice_mapping_t` on the
+ * `mappings` of `command`. Callbacks may keep pointers to the
+ * arguments, just like they do for `argv`, so it is only unmapped by
+ * `option_table_release` or `option_parse_release`.
+ */
+static bool response_open( command_t* command, const char* path ) {
+  long page = sysconf( _SC_PAGESIZE );
+  choice_mapping_t* mapping;
+  struct stat st;
+  size_t size;
+  char* base;
+  int fd;
+
+  if( command->depth == CHOICE_RESPONSE_DEPTH )
+    return false;
+  if( (fd = open( path, O_RDONLY )) < 0 )
+    return false;
+  if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ) {
+    close( fd );
+    return false;
+  }
+
+  size = ((size_t) st.st_size + 1 + sizeof(*mapping) + page - 1) / page * page;
+  base = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+  if( base == MAP_FAILED ) {
+    close( fd );
+    return false;
+  }
+  if( st.st_size > 0 &&
+      mmap( base, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fd, 0 ) == MAP_FAILED ) {
+    munmap( base, size );
+    close( fd );
+    return false;
+  }
+  close( fd );
+
+  mapping = (choice_mapping_t*) (base + size) - 1;
+  mapping->next = command->mappings;
+  mapping->size = size;
+  command->mappings = mapping;
+  command->files[command->depth].pos = base;
+  command->files[command->depth].end = base + st.st_size;
+  command->depth++;
+  return true;
+}
+
+/**
+ * Cut the next argument out of a response file, in place.
+ * Arguments are separated by white space; single and double quotes
+ * group, backslashes escape (except within single quotes).
+ * Returns `NULL` at the end of the file.
+ */
+static char* response_next( response_t* file ) {
+  char* pos = file->pos;
+  char* end = file->end;
+  char* out;
+  char* str;
+  char quote = '\0';
+
+  while( pos < end && isspace( (unsigned char) *pos ) )
+    pos++;
+  if( pos == end ) {
+    file->pos = pos;
+    return NULL;
+  }
+
+  for( str = out = pos; pos < end; pos++ ) {
+    if( quote != '\0' && *pos == quote ) {
+      quote = '\0';
+      continue;
+    } else if( quote == '\0' && (*pos == '\'' || *pos == '"') ) {
+      quote = *pos;
+      continue;
+    } else if( quote == '\0' && isspace( (unsigned char) *pos ) ) {
+      break;
+    } else if( quote != '\'' && *pos == '\\' && pos + 1 < end ) {
+      pos++;
+    }
+    *out++ = *pos;
+  }
+
+  file->pos = (pos < end) ? pos + 1 : pos;
+  *out = '\0';
+  return str;
+}
+
+/** Unmap a chain of response files. */
+static void response_release( choice_mapping_t* mapping ) {
+  choice_mapping_t* next;
+
+  for( ; mapping != NULL; mapping = next ) {
+    next = mapping->next;
+    munmap( (char*) (mapping + 1) - mapping->size, mapping->size );
+  }
+}
+
+/** Move the response files at `*from` to the front of `*chain`. */
+static void response_keep( choice_mapping_t** from, choice_mapping_t** chain ) {
+  choice_mapping_t* last = *from;
+
+  if( last == NULL )
+    return;
+  while( last->next != NULL )
+    last = last->next;
+  /* `option_parse` may run on several threads at once */
+  last->next = __atomic_load_n( chain, __ATOMIC_RELAXED );
+  while( !__atomic_compare_exchange_n( chain, &(last->next), *from, true,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+  *from = NULL;
+}
+
+/**
+ * Fetch the next argument, from the innermost response file or `argv`.
+ * Arguments of the form `@path` are replaced by the contents of the
+ * file, if it can be read; `@@` stands for a literal `@`.
+ */
+static char* arg_next( command_t* command ) {
+  char* str;
+
+  for( ;; ) {
+    if( command->depth > 0 ) {
+      if( (str = response_next( &(command->files[command->depth - 1]) )) == NULL ) {
+        command->depth--;
+        continue;
+      }
+    } else if( command->argc > 0 ) {
+      str = command->argv[0];
+      command->argc -= 1;
+      command->argv = &(command->argv[1]);
+    } else {
+      return NULL;
+    }
+
+    if( str[0] == '@' && str[1] == '@' ) {
+      str++;
+      break;
+    }
+    if( str[0] != '@' || !response_open( command, str + 1 ) )
+      break;
+  }
+
+#ifdef CHOICE_STATS
+  /* one argument ends where the next begins */
+  if( command->traced != NULL )
+    CHOICE_TRACE( CHOICE_TRACE_END, command->traced, command->index, 0 );
+  command->traced = str;
+  CHOICE_TRACE( CHOICE_TRACE_BEGIN, str, ++command->index, 0 );
+#endif
+  return str;
+}
+
+/**
+ * Shift one argument from the argv list.
+ */
+static char* arg_shiftstr( command_t* command ) {
+  char* str = command->arg;
+  command->arg = arg_next( command );
+  return str;
+}
+
+/**
+ * Shift one character from the current argument.
+ */
+static char arg_shiftc( command_t* command ) {
+  char c = command->arg[0];
+  command->arg += 1;
+  return c;
+}
+
+/**
+ * Shift characters from the current argument until either
+ * the passed character or the end of the string is reached.
+ */
+static char* arg_shiftstrchr( command_t* command, char c ) {
+  char* str = command->arg;
+  command->arg = strchrnul( str, c );
+  return str;
+}
+
+/**
+ * Split `len` characters of suboptions into `key[=value]` items,
+ * in one sweep over the string: a lane compare finds every `,` and `=`
+ * of a block at once, and the items are cut at the set bits. Only the
+ * first `=` of an item separates its value (which may be empty), and
+ * a trailing comma ends the list.
+ * Stores up to `max` items and returns their number; `*used` is where
+ * the next call has to continue.
+ */
+size_t choice_subopt_split( const char* str, size_t len, choice_item_t* items, size_t max,
+                            size_t* used ) {
+  lane_t commas = lane_set1( ',' ), equals = lane_set1( '=' ), block;
+  unsigned char tail[LANE_WIDTH];
+  unsigned comma, equal, marks, bit;
+  size_t base, pos, start = 0, eq = len, n = 0;
+
+  for( base = 0; base < len && n < max; base += LANE_WIDTH ) {
+    if( len - base >= LANE_WIDTH ) {
+      block = lane_load( (const unsigned char*) str + base );
+    } else {
+      memset( tail, 0, sizeof(tail) );
+      memcpy( tail, str + base, len - base );
+      block = lane_load( tail );
+    }
+    comma = lane_mask( lane_eq( block, commas ) );
+    equal = lane_mask( lane_eq( block, equals ) );
+
+    for( marks = comma | equal; marks != 0 && n < max; marks &= marks - 1 ) {
+      bit = __builtin_ctz( marks );
+      pos = base + bit;
+      if( !(comma & (1u << bit)) ) {
+        if( eq == len )
+          eq = pos;
+        continue;
+      }
+      items[n].key = str + start;
+      items[n].klen = ((eq < pos) ? eq : pos) - start;
+      items[n].value = (eq < pos) ? str + eq + 1 : NULL;
+      items[n].vlen = (eq < pos) ? pos - eq - 1 : 0;
+      n++;
+      start = pos + 1;
+      eq = len;
+    }
+  }
+
+  if( n < max && start < len ) {
+    items[n].key = str + start;
+    items[n].klen = ((eq < len) ? eq : len) - start;
+    items[n].value = (eq < len) ? str + eq + 1 : NULL;
+    items[n].vlen = (eq < len) ? len - eq - 1 : 0;
+    n++;
+    start = len;
+  }
+  *used = start;
+  return n;
+}
+
+/**
+ * Split `len` characters of a command string into words, the way a
+ * POSIX shell would: words are separated by white space, single quotes
+ * take everything up to the next one literally, and a backslash escapes
+ * the next character (within double quotes, only `$`, `` ` ``, `"`, `\`
+ * and a newline). A backslash before a newline joins the lines, so
+ * between words it is white space. Nothing is expanded. The words point
+ * into `str`, and only those that are `quoted` have to be unquoted.
+ * Stores up to `max` words and returns their number; `*used` is where
+ * the next call has to continue. A word with an open quote (or a
+ * backslash at the very end) is not stored, and `*used` stops before it.
+ */
+size_t choice_shell_split( const char* str, size_t len, choice_word_t* words, size_t max,
+                           size_t* used ) {
+  size_t pos = 0, start, n = 0;
+  bool quoted;
+  char quote;
+
+  for( *used = 0; n < max; *used = pos ) {
+    while( pos < len && (isspace( (unsigned char) str[pos] ) ||
+                         (str[pos] == '\\' && pos + 1 < len && str[pos+1] == '\n')) )
+      pos += (str[pos] == '\\') ? 2 : 1;
+    if( pos == len ) {
+      *used = pos;
+      break;
+    }
+
+    quoted = false;
+    quote = '\0';
+    for( start = pos; pos < len; pos++ ) {
+      if( quote == '\'' ) {
+        if( str[pos] == '\'' )
+          quote = '\0';
+      } else if( str[pos] == '\\' ) {
+        quoted = true;
+        if( ++pos == len )
+          quote = '\\';
+      } else if( quote == '"' ) {
+        if( str[pos] == '"' )
+          quote = '\0';
+      } else if( str[pos] == '\'' || str[pos] == '"' ) {
+        quoted = true;
+        quote = str[pos];
+      } else if( isspace( (unsigned char) str[pos] ) ) {
+        break;
+      }
+    }
+    if( quote != '\0' )
+      break;
+
+    words[n].str = str + start;
+    words[n].len = ((pos < len) ? pos : len) - start;
+    words[n].quoted = quoted;
+    n++;
+    /* the white space after a word is used up with it */
+    if( pos < len )
+      pos++;
+  }
+  return n;
+}
+
+/**
+ * Write the characters of `word` to `out` without its quotes and
+ * backslashes, and terminate them. `out` needs room for `word->len`
+ * characters and the terminator; it may be `word->str` itself.
+ * Returns the number of characters written (without the terminator).
+ */
+size_t choice_shell_unquote( const choice_word_t* word, char* out ) {
+  const char* str = word->str;
+  size_t pos, n = 0;
+  char quote = '\0';
+
+  for( pos = 0; pos < word->len; pos++ ) {
+    if( quote == '\'' ) {
+      if( str[pos] == '\'' ) {
+        quote = '\0';
+        continue;
+      }
+    } else if( str[pos] == '\\' && pos + 1 < word->len ) {
+      pos++;
+      if( str[pos] == '\n' )
+        continue;
+      if( quote == '"' && strchr( "$`\"\\", str[pos] ) == NULL )
+        out[n++] = '\\';
+    } else if( quote == '"' && str[pos] == '"' ) {
+      quote = '\0';
+      continue;
+    } else if( quote == '\0' && (str[pos] == '\'' || str[pos] == '"') ) {
+      quote = str[pos];
+      continue;
+    }
+    out[n++] = str[pos];
+  }
+  out[n] = '\0';
+  return n;
+}
+
+/** @} */
+
+/* MARK: option parsing *//**
+ * @name option parsing
+ * @{
+ */
+
+/**
+ * Describe an error on `stderr`. Depending on the error, `arg` (`len`
+ * characters of it) is either the name that was looked up or the
+ * parameter that was passed.
+ */
+static void option_message( int code, const option_t* option, const char* arg, int len ) {
+  switch( code ) {
+    case OPTION_EINVAL:
+      fprintf( stderr, "unknown option: `--%.*s'\n", len, arg );
+      break;
+    case OPTION_ENOARG:
+      fprintf( stderr, "option --%s does not take any parameters (%.*s)\n",
+               option->name, len, arg );
+      break;
+    case OPTION_EREQARG:
+      fprintf( stderr, "option --%s requires a parameter\n", option->name );
+      break;
+    case OPTION_EONCE:
+      fprintf( stderr, "option --%s may only occur once\n", option->name );
+      break;
+    case OPTION_EAMBIG:
+      fprintf( stderr, "option --%.*s is ambiguous (maybe --%s)\n", len, arg, option->name );
+      break;
+    case OPTION_ENOMEM:
+      fprintf( stderr, "out of memory\n" );
+      break;
+    case OPTION_EVALUE:
+      fprintf( stderr, "option --%s: invalid parameter `%.*s'\n", option->name, len, arg );
+      break;
+    case OPTION_ERANGE:
+      fprintf( stderr, "option --%s: parameter out of range `%.*s'\n", option->name, len, arg );
+      break;
+    case OPTION_EFILE:
+      fprintf( stderr, "can not read `%.*s'\n", len, arg );
+      break;
+    case OPTION_EDEPEND:
+      fprintf( stderr, "option --%s: not done, an option it depends on failed\n", option->name );
+      break;
+  }
+}
+
+static void option_error( command_t* command, option_t* option, int code, const char* arg ) {
+  option_message( code, option, arg, (arg != NULL) ? (int) strlen( arg ) : 0 );
+  longjmp( command->exc, code );
+}
+
+/** Print a "did you mean" for the unknown option `name`, if there is one. */
+static void option_suggest( command_t* command, const char* name ) {
+  option_t* suggestions[3];
+  int i, n = option_table_suggest( command->table, name, suggestions, 3 );
+
+  for( i = 0; i < n; i++ )
+    fprintf( stderr, "%s--%s", i ? ", " : "did you mean ", suggestions[i]->name );
+  if( n > 0 )
+    fprintf( stderr, "?\n" );
+}
+
+/**
+ * Call the callback of `option`.
+ * Suboptions parsed on behalf of an arena-backed table compile their
+ * table in the same arena.
+ */
+static int option_invoke( command_t* command, option_t* option, const char* arg ) {
+  if( option->callback == NULL )
+    return 0;
+  if( option->callback == &option_subopt && command->table->arena != NULL )
+    return subopt_parse_arena( option->data, (char*) arg, command->table->arena );
+  return CHOICE_CALL( option->callback, option, arg );
+}
+
+static int option_callback( command_t* command, option_t* option, const char* arg ) {
+  int error;
+
+  if( arg != NULL && *arg == '\0' )
+    arg = NULL;
+
+  if( arg == NULL && (option->flags & OPTION_REQARG) )
+    return OPTION_EREQARG;
+  else if( arg != NULL && !(option->flags & OPTION_ARG) )
+    return OPTION_ENOARG;
+
+  if( option->callback && (error = option_invoke( command, option, arg )) ) {
+    /* suboptions have described their error already */
+    if( option->callback == &option_subopt || option->callback == &option_subtable )
+      longjmp( command->exc, error );
+    option_error( command, option, error, arg );
+  }
+
+  return 0;
+}
+
+/* the `@file`s of `option_parse`, which has no table to keep them */
+static choice_mapping_t* parsed;
+
+int option_parse( option_t* options, int argc, char* argv[] ) {
+  option_table_t table;
+  int error;
+
+  if( (error = option_table_init( &table, options )) )
+    return error;
+  error = option_table_parse( &table, argc, argv );
+  response_keep( &(table.mappings), &parsed );
+  option_table_free( &table );
+  return error;
+}
+
+/**
+ * Same as `option_parse`, but the option table (and those of any
+ * suboptions) is compiled in `arena`, so the parse never touches
+ * the heap. Fails with `OPTION_ENOMEM` if the arena is too small.
+ * The arena is left as it was found.
+ */
+int option_parse_arena( option_t* options, int argc, char* argv[], choice_arena_t* arena ) {
+  option_table_t table;
+  size_t used = arena->used;
+  int error;
+
+  if( (error = option_table_init_arena( &table, options, arena )) == 0 ) {
+    error = option_table_parse( &table, argc, argv );
+    response_keep( &(table.mappings), &parsed );
+  }
+  arena->used = used;
+  return error;
+}
+
+/**
+ * Unmap the `@file`s expanded by `option_parse` and `option_parse_arena`
+ * so far. Callbacks must no longer hold on to the arguments they read
+ * from them.
+ */
+void option_parse_release( void ) {
+  response_release( __atomic_exchange_n( &parsed, NULL, __ATOMIC_ACQUIRE ) );
+}
+
+/**
+ * Descend into the subcommand `option`: compile its table, if that has
+ * not happened yet, and resolve names there first from now on. The
+ * command is marked `OPTION_CALLED`.
+ */
+static void command_enter( command_t* command, option_t* option ) {
+  option_table_t* table = option_table_child( command->table, option );
+
+  if( table == NULL && (option->data == NULL || option_table_invalid( option->data )) )
+    option_error( command, option, OPTION_EINVAL, option->name );
+  if( table == NULL )
+    option_error( command, option, OPTION_ENOMEM, NULL );
+  option->flags |= OPTION_CALLED;
+  command->name = option->name;
+  command->table = table;
+  command->levels[++command->level] = table;
+}
+
+/**
+ * Walk the arguments of `command`, calling back as options are found.
+ * Returns an error code, or 0 once the arguments (or the options among
+ * them) are used up.
+ */
+static int option_command_parse( command_t* command ) {
+  option_t* option = NULL;
+
+#define S_ANY 0
+#define S_ARG 1
+#define S_ABBR 2
+#define S_NAME 3
+#define S_DONE 4
+#define ARG (command->arg)
+
+  char* name;
+  char abbr;
+  char* arg;
+  int state = S_ANY, error = 0;
+
+  if( (error = setjmp(command->exc)) ) {
+    return error;
+  }
+
+  command->arg = arg_next( command );
+  while( command->arg != NULL ) {
+
+    switch( state ) {
+      case S_ANY:
+        if( ARG[0] == '-' ) {
+          if( option ) {
+            option_callback( command, option, NULL );
+            option = NULL;
+          }
+          if( ARG[1] == '-' ) {
+            ARG += 2;
+            state = S_NAME;
+          } else if( ARG[1] != '\0' ) {
+            ARG += 1;
+            state = S_ABBR;
+          }
+          break;
+        } else if( option == NULL && (option = option_by_word( command, ARG )) != NULL ) {
+          if( option->callback == &option_command ) {
+            if( command->level + 1 == CHOICE_COMMAND_DEPTH )
+              option_error( command, option, OPTION_ENOMEM, NULL );
+            command_enter( command, option );
+            arg_shiftstr( command );
+            option = NULL;
+          } else if( option->flags & OPTION_ARG ) {
+            arg_shiftstr( command );
+            state = (option->flags & OPTION_REQARG) ? S_ARG : S_ANY;
+          } else {
+            arg_shiftstr( command );
+            option_callback( command, option, NULL );
+            option = NULL;
+          }
+          break;
+        }
+      case S_ARG:
+        if( option == NULL ) {
+          state = S_DONE;
+        } else {
+          arg = arg_shiftstr( command );
+          option_callback( command, option, arg );
+          option = NULL;
+          state = S_ANY;
+        }
+        break;
+      case S_ABBR:
+        abbr = arg_shiftc( command );
+        if( abbr == '\0' ) {
+          /* end of abbreviated option list */
+          arg_shiftstr( command );
+          state = S_ANY;
+        } else {
+          /* todo, only match with OPTION_NODASH not set */
+          option = option_by_abbr( command, 0, abbr );
+          if( option == NULL ) {
+            /* unknown option */
+            fprintf( stderr, "unknown option -%c!\n", abbr );
+            return OPTION_EINVAL;
+          }
+          if( option->flags & OPTION_ARG ) {
+            arg = arg_shiftstr( command );
+            if( arg[0] != '\0' ) {
+              option_callback( command, option, arg );
+              option = NULL;
+              state = S_ANY;
+            } else {
+              state = (option->flags & OPTION_REQARG) ? S_ARG : S_ANY;
+            }
+          } else {
+            option_callback( command, option, NULL );
+            option = NULL;
+            state = S_ABBR;
+          }
+        }
+        break;
+      case S_NAME:
+        name = arg_shiftstrchr( command, '=' );
+        arg  = arg_shiftstr( command );
+        if( arg[0] == '=' ) *arg++ = '\0';
+        if( *name == '\0' ) {
+          /* "--" */
+          arg_shiftstr( command );
+          state = S_DONE;
+        } else {
+          /* todo, only match with OPTION_NODASH not set */
+          option = option_by_name( command, 0, name );
+          if( option == NULL ) {
+            /* unknown option */
+            fprintf( stderr, "unknown option --%s!\n", name );
+            option_suggest( command, name );
+            return OPTION_EINVAL;
+          }
+          if( option->flags & OPTION_ARG ) {
+            if( arg[0] != '\0' ) {
+              option_callback( command, option, arg );
+              option = NULL;
+              state = S_ANY;
+            } else {
+              state = (option->flags & OPTION_REQARG) ? S_ARG : S_ANY;
+            }
+          } else if( arg[0] != '\0' ) {
+            /* does not take args */
+            fprintf( stderr, "option --%s does not take parameters (%s)!\n", option->name, arg );
+            return OPTION_ENOARG;
+          } else {
+            option_callback( command, option, NULL );
+            option = NULL;
+            state = S_ANY;
+          }
+        }
+        break;
+      case S_DONE:
+        return 0;
+    }
+  }
+
+#undef S_ANY
+#undef S_ARG
+#undef S_ABBR
+#undef S_NAME
+#undef S_DONE
+#undef ARG
+  return 0;
+}
+
+int option_table_parse( option_table_t* table, int argc, char* argv[] ) {
+  command_t command = { table, argv[0], argc - 1, &(argv[1]) };
+  int error;
+
+  CHOICE_COUNT( parses, 1 );
+  command.levels[0] = table;
+  error = option_command_parse( &command );
+  response_keep( &(command.mappings), &(table->mappings) );
+  if( command.traced != NULL )
+    CHOICE_TRACE( CHOICE_TRACE_END, command.traced, command.index, error );
+  return error;
+}
+
+int subopt_parse( option_t* options, char* argv ) {
+  option_table_t table;
+  int error;
+
+  if( (error = option_table_init( &table, options )) )
+    return error;
+  error = subopt_table_parse( &table, argv );
+  option_table_free( &table );
+  return error;
+}
+
+/** Same as `subopt_parse`, but compile the table in `arena`. */
+int subopt_parse_arena( option_t* options, char* argv, choice_arena_t* arena ) {
+  option_table_t table;
+  size_t used = arena->used;
+  int error;
+
+  if( (error = option_table_init_arena( &table, options, arena )) == 0 )
+    error = subopt_table_parse( &table, argv );
+  arena->used = used;
+  return error;
+}
+
+int subopt_table_parse( option_table_t* table, char* argv ) {
+  command_t command = { table, NULL, 1, &argv };
+  choice_item_t items[CHOICE_SUBOPT_BATCH];
+  option_t* options[CHOICE_SUBOPT_BATCH];
+  option_t* ambigs[CHOICE_SUBOPT_BATCH];
+  size_t len = strlen( argv ), used, n, i;
+  char* arg;
+  int error;
+
+  CHOICE_COUNT( parses, 1 );
+  while( len > 0 ) {
+    n = choice_subopt_split( argv, len, items, CHOICE_SUBOPT_BATCH, &used );
+
+    /* resolve the whole batch, then call back in order */
+    for( i = 0; i < n; i++ )
+      options[i] = option_lookup( table, OPTION_NODASH, items[i].key, items[i].klen, &ambigs[i] );
+
+    for( i = 0; i < n; i++ ) {
+      ((char*) items[i].key)[items[i].klen] = '\0';
+      if( items[i].value != NULL )
+        ((char*) items[i].value)[items[i].vlen] = '\0';
+      arg = (items[i].value != NULL) ? (char*) items[i].value : "";
+
+      if( options[i] == NULL ) {
+        error = (ambigs[i] != NULL) ? OPTION_EAMBIG : OPTION_EINVAL;
+        option_message( error, ambigs[i], items[i].key, (int) items[i].klen );
+        return error;
+      }
+      if( arg[0] == '\0' && (options[i]->flags & OPTION_REQARG) )
+        error = OPTION_EREQARG;
+      else if( arg[0] != '\0' && !(options[i]->flags & OPTION_ARG) )
+        error = OPTION_ENOARG;
+      else
+        error = option_invoke( &command, options[i], (arg[0] != '\0') ? arg : NULL );
+      if( error ) {
+        option_message( error, options[i], arg, (int) strlen( arg ) );
+        return error;
+      }
+    }
+    argv += used;
+    len -= used;
+  }
+  return 0;
+}
+
+/** @} */
+
+/* MARK: reentrant parsing *//**
+ * @name reentrant parsing
+ * The `choice_parse` family never writes to the arguments, never leaves
+ * through `longjmp` and keeps all of its state in a `choice_parser_t`,
+ * so any number of threads can parse against one shared table.
+ * Names and parameters are looked at as pointer and length; callbacks
+ * get suffixes of the arguments, which are terminated already. Only a
+ * suboption parameter followed by more suboptions has to be copied, to
+ * the stack (up to `CHOICE_VALUE_MAX` characters).
+ * @{
+ */
+
+/** Prepare `parser` to parse against the compiled `table`. */
+void choice_parser_init( choice_parser_t* parser, const option_table_t* table ) {
+  memset( parser, 0, sizeof(*parser) );
+  parser->table = table;
+}
+
+/** Record an error in `parser` and return its code. */
+static int choice_fail( choice_parser_t* parser, int code, option_t* option,
+                        const char* arg, size_t len, int index ) {
+  parser->error.code = code;
+  parser->error.option = option;
+  parser->error.arg = arg;
+  parser->error.len = len;
+  parser->error.index = index;
+  return code;
+}
+
+/** Describe the last error of a parser on `stderr`, like `option_parse` would. */
+void choice_perror( const choice_error_t* error ) {
+  option_message( error->code, error->option, error->arg, (int) error->len );
+}
+
+/**
+ * Resolve `len` characters of `str` against `table`, or record why not.
+ */
+static option_t* choice_lookup( choice_parser_t* parser, const option_table_t* table, int flags,
+                                const char* str, size_t len, int index ) {
+  option_t* ambig;
+  option_t* option = option_lookup( table, flags, str, len, &ambig );
+
+  if( ambig != NULL )
+    choice_fail( parser, OPTION_EAMBIG, ambig, str, len, index );
+  else if( option == NULL )
+    choice_fail( parser, OPTION_EINVAL, NULL, str, len, index );
+  return option;
+}
+
+/** The `data` the callback of `option` gets from `choice_call`. */
+static void* choice_target( const choice_parser_t* parser, const option_t* option ) {
+  const option_table_t* table = parser->table;
+  size_t offset;
+
+  if( parser->offsets != NULL &&
+      option >= table->options && option < table->options + table->count &&
+      (offset = parser->offsets[option - table->options]) != CHOICE_NO_OFFSET )
+    return (char*) parser->record + offset;
+  return option->data;
+}
+
+/**
+ * Call the callback of `option`. With an offset map, options of the
+ * parser's own table store into `parser->record` instead of `data`.
+ */
+static int choice_call( choice_parser_t* parser, option_t* option, const char* arg ) {
+  void* data = choice_target( parser, option );
+  option_t copy;
+
+  if( data != option->data ) {
+    memcpy( &copy, option, sizeof(copy) );
+    copy.data = data;
+    return CHOICE_CALL( option->callback, &copy, arg );
+  }
+  return CHOICE_CALL( option->callback, option, arg );
+}
+
+/**
+ * Keep a copy of `len` characters of `str` for as long as `defer`,
+ * for the parameters that are not terminated in the arguments.
+ */
+static const char* choice_copy( choice_defer_t* defer, const char* str, size_t len ) {
+  char* copy = malloc( sizeof(char*) + len + 1 );
+
+  if( copy == NULL )
+    return NULL;
+  memcpy( copy, &(defer->copies), sizeof(char*) );
+  memcpy( copy + sizeof(char*), str, len );
+  copy[sizeof(char*) + len] = '\0';
+  defer->copies = copy;
+  return copy + sizeof(char*);
+}
+
+/** Record the callback of `option` in the parser's `defer`, for later. */
+static int choice_record( choice_parser_t* parser, option_t* option, const char* arg, int index ) {
+  choice_defer_t* defer = parser->defer;
+  choice_event_t* events = defer->events;
+  size_t capacity;
+
+  if( defer->count == defer->capacity ) {
+    capacity = (defer->capacity > 0) ? 2 * defer->capacity : CHOICE_LIST_MIN;
+    if( (events = realloc( events, capacity * sizeof(*events) )) == NULL )
+      return choice_fail( parser, OPTION_ENOMEM, option, arg, (arg != NULL) ? strlen( arg ) : 0, index );
+    defer->events = events;
+    defer->capacity = capacity;
+  }
+  memset( &(events[defer->count]), 0, sizeof(*events) );
+  events[defer->count].option = option;
+  events[defer->count].arg = arg;
+  events[defer->count].index = index;
+  defer->count++;
+  return 0;
+}
+
+/**
+ * Check the parameter and call the callback of `option`, like
+ * `option_callback`. Suboptions are parsed without writing to `arg`,
+ * and errors returned by callbacks are recorded.
+ */
+static int choice_invoke( choice_parser_t* parser, option_t* option, const char* arg, int index ) {
+  option_table_t table;
+  size_t used = (parser->arena != NULL) ? parser->arena->used : 0;
+  unsigned char* source;
+  int error;
+
+  if( arg != NULL && *arg == '\0' )
+    arg = NULL;
+
+  if( arg == NULL && (option->flags & OPTION_REQARG) )
+    return choice_fail( parser, OPTION_EREQARG, option, NULL, 0, index );
+  else if( arg != NULL && !(option->flags & OPTION_ARG) )
+    return choice_fail( parser, OPTION_ENOARG, option, arg, strlen( arg ), index );
+
+  if( parser->sources != NULL &&
+      option >= parser->table->options && option < parser->table->options + parser->table->count ) {
+    source = &(parser->sources[option - parser->table->options]);
+    if( *source > parser->source )
+      return 0;
+    if( *source < parser->source )
+      choice_list_reset( option );
+    *source = parser->source;
+  }
+
+  if( parser->defer != NULL && option->callback != NULL &&
+      option->callback != &option_subtable && option->callback != &option_subopt )
+    return choice_record( parser, option, arg, index );
+
+  if( arg == NULL && (option->callback == &option_subtable || option->callback == &option_subopt) ) {
+    /* an optional list of suboptions that was left out */
+    return 0;
+  } else if( option->callback == &option_subtable ) {
+    return choice_parse_subopt( parser, option->data, arg, strlen( arg ) );
+  } else if( option->callback == &option_subopt ) {
+    if( parser->arena != NULL ) {
+      error = option_table_init_arena( &table, option->data, parser->arena );
+    } else {
+      error = option_table_init( &table, option->data );
+    }
+    if( error )
+      return choice_fail( parser, error, option, arg, strlen( arg ), index );
+    error = choice_parse_subopt( parser, &table, arg, strlen( arg ) );
+    if( parser->arena != NULL )
+      parser->arena->used = used;
+    else
+      option_table_free( &table );
+    return error;
+  } else if( option->callback != NULL ) {
+    if( (error = choice_call( parser, option, arg )) )
+      return choice_fail( parser, error, option, arg, (arg != NULL) ? strlen( arg ) : 0, index );
+  }
+  return 0;
+}
+
+/**
+ * Names of long options resolved ahead of the parse, by argument:
+ * the option, or the best match if it was ambiguous.
+ */
+typedef struct choice_resolved_s {
+  option_t* option;
+  option_t* ambig;
+} choice_resolved_t;
+
+/**
+ * Long options of `argv`, resolved `CHOICE_PARALLEL_CHUNK` arguments
+ * (one chunk) at a time, by whichever thread claims the chunk next.
+ * `done` marks the chunks that are resolved; `stop` tells the threads
+ * that no more are needed.
+ */
+typedef struct choice_resolver_s {
+  const option_table_t* table;
+  const char* const* argv;
+  int argc;
+  unsigned chunks;
+  unsigned next;
+  bool stop;
+  bool* done;
+  choice_resolved_t* resolved;
+} choice_resolver_t;
+
+/** Claim the next chunk and resolve it. Returns `false` if there is none. */
+static bool choice_resolve_chunk( choice_resolver_t* resolver ) {
+  unsigned chunk = __atomic_fetch_add( &(resolver->next), 1, __ATOMIC_RELAXED );
+  const char* arg;
+  const char* value;
+  int i, end;
+
+  if( chunk >= resolver->chunks )
+    return false;
+  i = 1 + chunk * CHOICE_PARALLEL_CHUNK;
+  end = (i < resolver->argc - CHOICE_PARALLEL_CHUNK) ? i + CHOICE_PARALLEL_CHUNK : resolver->argc;
+  for( ; i < end; i++ ) {
+    arg = resolver->argv[i];
+    if( arg[0] != '-' || arg[1] != '-' || arg[2] == '\0' )
+      continue;
+    arg += 2;
+    value = strchrnul( (char*) arg, '=' );
+    resolver->resolved[i].option = option_lookup( resolver->table, 0, arg, value - arg,
+                                                  &(resolver->resolved[i].ambig) );
+  }
+  __atomic_store_n( &(resolver->done[chunk]), true, __ATOMIC_RELEASE );
+  return true;
+}
+
+/**
+ * What the long option `argv[i]` resolved to. Until its chunk is done,
+ * help resolving the chunks that are left.
+ */
+static const choice_resolved_t* choice_resolved( choice_resolver_t* resolver, int i ) {
+  unsigned chunk = (i - 1) / CHOICE_PARALLEL_CHUNK;
+
+  while( !__atomic_load_n( &(resolver->done[chunk]), __ATOMIC_ACQUIRE ) )
+    if( !choice_resolve_chunk( resolver ) )
+      sched_yield();
+  return &(resolver->resolved[i]);
+}
+
+/**
+ * `choice_parse`, taking what long options resolve to from `resolver`
+ * (if set) instead of looking them up.
+ */
+static int choice_parse_resolved( choice_parser_t* parser, int argc, const char* const argv[],
+                                  choice_resolver_t* resolver ) {
+  const option_table_t* table = parser->table;
+  const choice_resolved_t* resolved;
+  option_t* option;
+  const char* arg;
+  const char* value;
+  unsigned index;
+  int i, start, error = 0;
+
+  CHOICE_COUNT( parses, 1 );
+  parser->positionals = 0;
+  for( i = 1; i < argc && error == 0; i++ ) {
+    parser->index = i;
+    arg = argv[i];
+    if( arg[0] != '-' || arg[1] == '\0' ) {
+      if( parser->positional == NULL )
+        break;
+      parser->positional[parser->positionals++] = arg;
+      continue;
+    } else if( arg[1] == '-' && arg[2] == '\0' ) {
+      /* "--" */
+      for( i++; parser->positional != NULL && i < argc; i++ )
+        parser->positional[parser->positionals++] = argv[i];
+      break;
+    }
+
+    start = i;
+    CHOICE_TRACE( CHOICE_TRACE_BEGIN, arg, start, 0 );
+    if( arg[1] == '-' ) {
+      arg += 2;
+      value = strchrnul( (char*) arg, '=' );
+      if( resolver != NULL ) {
+        resolved = choice_resolved( resolver, i );
+        if( (option = resolved->option) == NULL )
+          choice_fail( parser, (resolved->ambig != NULL) ? OPTION_EAMBIG : OPTION_EINVAL,
+                       resolved->ambig, arg, value - arg, i );
+      } else {
+        option = choice_lookup( parser, table, 0, arg, value - arg, i );
+      }
+      if( option == NULL ) {
+        CHOICE_TRACE( CHOICE_TRACE_END, argv[start], start, parser->error.code );
+        return parser->error.code;
+      }
+      if( *value == '=' )
+        value++;
+
+      if( *value != '\0' ) {
+        error = choice_invoke( parser, option, value, i );
+      } else if( (option->flags & OPTION_ARG) && i + 1 < argc &&
+                 (argv[i+1][0] != '-' || ((option->flags & OPTION_REQARG) && argv[i+1][1] == '\0')) ) {
+        i++;
+        error = choice_invoke( parser, option, argv[i], i );
+      } else {
+        error = choice_invoke( parser, option, NULL, i );
+      }
+    } else {
+      for( arg++; *arg != '\0' && error == 0; arg++ ) {
+        CHOICE_COUNT( abbr, 1 );
+        index = table->abbr[(unsigned char) *arg];
+        if( index == 0 ) {
+          error = choice_fail( parser, OPTION_EINVAL, NULL, arg, 1, i );
+          CHOICE_TRACE( CHOICE_TRACE_END, argv[start], start, error );
+          return error;
+        }
+        option = &(table->options[index - 1]);
+
+        if( !(option->flags & OPTION_ARG) ) {
+          error = choice_invoke( parser, option, NULL, i );
+        } else if( arg[1] != '\0' ) {
+          error = choice_invoke( parser, option, arg + 1, i );
+          break;
+        } else if( i + 1 < argc &&
+                   (argv[i+1][0] != '-' || ((option->flags & OPTION_REQARG) && argv[i+1][1] == '\0')) ) {
+          i++;
+          error = choice_invoke( parser, option, argv[i], i );
+          break;
+        } else {
+          error = choice_invoke( parser, option, NULL, i );
+        }
+      }
+    }
+    CHOICE_TRACE( CHOICE_TRACE_END, argv[start], start, error );
+  }
+
+  parser->index = i;
+  return error;
+}
+
+/**
+ * Parse `argv` (skipping the program name) against the table of `parser`.
+ * Stops at the first argument that is not an option, or after `--`, and
+ * leaves its index in `parser->index` (while parsing, it is the index
+ * of the current argument). Returns 0, or the error code that
+ * is also recorded in `parser->error`.
+ * With `parser->positional`, the arguments that are not options are
+ * set aside instead, in one pass, and the parse goes on to the end.
+ * Unlike `option_parse`, an option never takes the next argument as its
+ * parameter if that looks like an option (starts with `-`, but is not
+ * just `-`): give it as `--name=-x` or `-n-x`. And a required parameter
+ * that is missing, at the end of `argv` or before such an argument,
+ * fails with `OPTION_EREQARG` instead of being ignored.
+ */
+int choice_parse( choice_parser_t* parser, int argc, const char* const argv[] ) {
+  return choice_parse_resolved( parser, argc, argv, NULL );
+}
+/**
+ * Parse `len` characters of `str` as suboptions against `table`,
+ * like `subopt_table_parse`, without writing to `str`.
+ */
+int choice_parse_subopt( choice_parser_t* parser, const option_table_t* table,
+                         const char* str, size_t len ) {
+  char value[CHOICE_VALUE_MAX];
+  choice_item_t items[CHOICE_SUBOPT_BATCH];
+  option_t* options[CHOICE_SUBOPT_BATCH];
+  option_t* ambigs[CHOICE_SUBOPT_BATCH];
+  const char* arg;
+  size_t used, n, i;
+  int error;
+
+  CHOICE_COUNT( parses, 1 );
+  while( len > 0 ) {
+    n = choice_subopt_split( str, len, items, CHOICE_SUBOPT_BATCH, &used );
+
+    /* resolve the whole batch, then call back in order */
+    for( i = 0; i < n; i++ )
+      options[i] = option_lookup( table, OPTION_NODASH, items[i].key, items[i].klen, &ambigs[i] );
+
+    for( i = 0; i < n; i++ ) {
+      if( options[i] == NULL )
+        return choice_fail( parser, (ambigs[i] != NULL) ? OPTION_EAMBIG : OPTION_EINVAL, ambigs[i],
+                            items[i].key, items[i].klen, parser->index );
+
+      arg = items[i].value;
+      if( arg != NULL && arg[items[i].vlen] != '\0' ) {
+        /* only the last parameter is terminated already */
+        if( parser->defer != NULL ) {
+          if( (arg = choice_copy( parser->defer, arg, items[i].vlen )) == NULL )
+            return choice_fail( parser, OPTION_ENOMEM, options[i], items[i].value, items[i].vlen,
+                                parser->index );
+        } else if( items[i].vlen >= CHOICE_VALUE_MAX ) {
+          return choice_fail( parser, OPTION_ENOMEM, options[i], arg, items[i].vlen, parser->index );
+        } else {
+          memcpy( value, arg, items[i].vlen );
+          value[items[i].vlen] = '\0';
+          arg = value;
+        }
+      }
+      if( (error = choice_invoke( parser, options[i], arg, parser->index )) )
+        return error;
+    }
+    str += used;
+    len -= used;
+  }
+  return 0;
+}
+
+/**
+ * Parse the command string `str` (program name first) like the shell
+ * would have passed it on to `choice_parse`. It is cut into arguments
+ * in place, one word at a time: a plain word is terminated where it
+ * ends, and only quoted words are moved together. The arguments go to
+ * `argv` (of `max` entries), so callbacks may keep pointers into `str`
+ * and positional arguments start at `argv[parser->index]`.
+ * Fails with `OPTION_ENOMEM` if there are more than `max` arguments,
+ * and with `OPTION_EVALUE` on an open quote.
+ */
+int choice_parse_shell( choice_parser_t* parser, char* str, const char* argv[], int max ) {
+  choice_word_t word;
+  size_t len = strlen( str ), used;
+  int argc = 0;
+
+  while( choice_shell_split( str, len, &word, 1, &used ) == 1 ) {
+    if( argc == max )
+      return choice_fail( parser, OPTION_ENOMEM, NULL, word.str, word.len, argc );
+    if( word.quoted )
+      choice_shell_unquote( &word, (char*) word.str );
+    else
+      ((char*) word.str)[word.len] = '\0';
+    argv[argc++] = word.str;
+    str += used;
+    len -= used;
+  }
+  if( used < len )
+    return choice_fail( parser, OPTION_EVALUE, NULL, str + used, len - used, argc );
+  if( argc < max )
+    argv[argc] = NULL;
+  return choice_parse( parser, argc, argv );
+}
+
+/** @} */
+
+/* MARK: incremental parsing *//**
+ * @name incremental parsing
+ * Check a command line as it is being typed. A `choice_line_t` keeps
+ * the line and its tokens (split at white space outside of quotes),
+ * and takes edits: only the tokens an edit touches are split up and
+ * looked up again. The rest keep what their names resolved to, and
+ * are only classified again (option, parameter, positional argument)
+ * until the classification is the same as before. Nothing is called
+ * back; the line means what `choice_parse` would make of it.
+ * @{
+ */
+
+#define LINE_OPTIONS 0
+#define LINE_PARAM 1
+#define LINE_REST 2
+
+/** Prepare `line` to check lines against the compiled `table`. */
+void choice_line_init( choice_line_t* line, const option_table_t* table ) {
+  memset( line, 0, sizeof(*line) );
+  line->table = table;
+}
+
+/** Release the text and tokens of `line`. */
+void choice_line_free( choice_line_t* line ) {
+  free( line->text );
+  free( line->tokens );
+  choice_line_init( line, line->table );
+}
+
+/** Skip the white space at `pos` of the line. */
+static size_t line_skip( const choice_line_t* line, size_t pos ) {
+  while( pos < line->len && isspace( (unsigned char) line->text[pos] ) )
+    pos++;
+  return pos;
+}
+
+/**
+ * Find the end of the token at `pos`: the next white space that is
+ * neither quoted nor escaped (like in a response file).
+ */
+static size_t line_token_end( const choice_line_t* line, size_t pos ) {
+  const char* text = line->text;
+  char quote = '\0';
+
+  for( ; pos < line->len; pos++ ) {
+    if( quote != '\0' && text[pos] == quote )
+      quote = '\0';
+    else if( quote == '\0' && (text[pos] == '\'' || text[pos] == '"') )
+      quote = text[pos];
+    else if( quote == '\0' && isspace( (unsigned char) text[pos] ) )
+      break;
+    else if( quote != '\'' && text[pos] == '\\' && pos + 1 < line->len )
+      pos++;
+  }
+  return pos;
+}
+
+/**
+ * Look up what `token` names, which only depends on its text: the
+ * option (the last one of a group of abbreviations), the error, and
+ * whether it would take the next token as its parameter.
+ */
+static void line_resolve( choice_line_t* line, choice_token_t* token ) {
+  const option_table_t* table = line->table;
+  const char* str = line->text + token->pos;
+  const char* end = str + token->len;
+  const char* value;
+  option_t* ambig;
+  unsigned index;
+
+  token->resolved = NULL;
+  token->lookup = 0;
+  token->takes = false;
+  if( token->len < 2 || str[0] != '-' || (token->len == 2 && str[1] == '-') )
+    return;
+
+  line->lookups++;
+  if( str[1] == '-' ) {
+    str += 2;
+    if( (value = memchr( str, '=', end - str )) == NULL )
+      value = end;
+    token->resolved = option_lookup( table, 0, str, value - str, &ambig );
+    if( ambig != NULL ) {
+      token->resolved = ambig;
+      token->lookup = OPTION_EAMBIG;
+    } else if( token->resolved == NULL ) {
+      token->lookup = OPTION_EINVAL;
+    } else if( value + 1 < end ) {
+      if( !(token->resolved->flags & OPTION_ARG) )
+        token->lookup = OPTION_ENOARG;
+    } else {
+      token->takes = (token->resolved->flags & OPTION_ARG) != 0;
+    }
+  } else {
+    for( str++; str < end; str++ ) {
+      if( (index = table->abbr[(unsigned char) *str]) == 0 ) {
+        token->resolved = NULL;
+        token->lookup = OPTION_EINVAL;
+        return;
+      }
+      token->resolved = &(table->options[index - 1]);
+      if( token->resolved->flags & OPTION_ARG ) {
+        token->takes = (str + 1 == end);
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * Classify token `i`, entered in `state` (`owner` waiting for its
+ * parameter, in `LINE_PARAM`). A required parameter that is not there
+ * is an error of the token before. Returns the state of the next token.
+ */
+static int line_derive( choice_line_t* line, unsigned i, int state, option_t* owner ) {
+  choice_token_t* token = &(line->tokens[i]);
+  const char* str = line->text + token->pos;
+
+  token->state = state;
+  token->owner = owner;
+  token->option = NULL;
+  token->error = 0;
+
+  if( state == LINE_PARAM ) {
+    if( str[0] != '-' || (token->len == 1 && (owner->flags & OPTION_REQARG)) ) {
+      token->kind = CHOICE_TOKEN_PARAM;
+      token->option = owner;
+      return LINE_OPTIONS;
+    }
+    if( owner->flags & OPTION_REQARG )
+      line->tokens[i - 1].error = OPTION_EREQARG;
+    state = LINE_OPTIONS;
+  }
+
+  if( state == LINE_REST ) {
+    token->kind = CHOICE_TOKEN_ARG;
+    return LINE_REST;
+  } else if( token->len == 2 && str[0] == '-' && str[1] == '-' ) {
+    token->kind = CHOICE_TOKEN_END;
+    return LINE_REST;
+  } else if( str[0] != '-' || token->len == 1 ) {
+    token->kind = CHOICE_TOKEN_ARG;
+    return LINE_REST;
+  }
+  token->kind = CHOICE_TOKEN_OPTION;
+  token->option = token->resolved;
+  token->error = token->lookup;
+  return (token->lookup == 0 && token->takes) ? LINE_PARAM : LINE_OPTIONS;
+}
+
+/**
+ * Replace `del` characters at `pos` of the line by `len` characters of
+ * `str`, and bring the tokens up to date. `lookups` counts the names
+ * that had to be looked up for it. Returns 0, or `OPTION_ENOMEM`, in
+ * which case the line is emptied.
+ */
+int choice_line_edit( choice_line_t* line, size_t pos, size_t del, const char* str, size_t len ) {
+  choice_token_t* tokens = line->tokens;
+  size_t start, cursor, end, size;
+  char* text;
+  unsigned a, b, i, k, lo, hi, count;
+  option_t* owner;
+  int state;
+
+  if( pos > line->len )
+    pos = line->len;
+  if( del > line->len - pos )
+    del = line->len - pos;
+  line->lookups = 0;
+
+  /* edit the text */
+  if( line->len - del + len + 1 > line->size ) {
+    size = 2 * (line->len - del + len + 1);
+    if( (text = realloc( line->text, size )) == NULL ) {
+      choice_line_free( line );
+      return OPTION_ENOMEM;
+    }
+    line->text = text;
+    line->size = size;
+  }
+  memmove( line->text + pos + len, line->text + pos + del, line->len - pos - del );
+  memcpy( line->text + pos, str, len );
+  line->len = line->len - del + len;
+  line->text[line->len] = '\0';
+
+  /* the old tokens [a, b) touch the edit (or are joined to it) */
+  for( lo = 0, hi = line->count; lo < hi; ) {
+    i = lo + (hi - lo) / 2;
+    if( tokens[i].pos + tokens[i].len < pos ) lo = i + 1; else hi = i;
+  }
+  a = lo;
+  for( hi = line->count; lo < hi; ) {
+    i = lo + (hi - lo) / 2;
+    if( tokens[i].pos <= pos + del ) lo = i + 1; else hi = i;
+  }
+  b = lo;
+
+  /* split up the edited text until a token starts where an old one did */
+  start = cursor = (a < b && tokens[a].pos < pos) ? tokens[a].pos : pos;
+  for( k = 0;; k++ ) {
+    cursor = line_skip( line, cursor );
+    if( cursor == line->len ) {
+      b = line->count;
+      break;
+    }
+    if( b < line->count && cursor == tokens[b].pos - del + len )
+      break;
+    end = line_token_end( line, cursor );
+    while( b < line->count && tokens[b].pos - del + len < end )
+      b++;
+    cursor = end;
+  }
+
+  count = line->count - (b - a) + k;
+  if( count > line->capacity ) {
+    if( (tokens = realloc( tokens, 2 * count * sizeof(*tokens) )) == NULL ) {
+      choice_line_free( line );
+      return OPTION_ENOMEM;
+    }
+    line->tokens = tokens;
+    line->capacity = 2 * count;
+  }
+  if( b < line->count )
+    memmove( tokens + a + k, tokens + b, (line->count - b) * sizeof(*tokens) );
+  for( i = a + k; i < count; i++ )
+    tokens[i].pos = tokens[i].pos - del + len;
+  line->count = count;
+
+  for( cursor = start, i = a; i < a + k; i++ ) {
+    cursor = line_skip( line, cursor );
+    end = line_token_end( line, cursor );
+    tokens[i].pos = cursor;
+    tokens[i].len = end - cursor;
+    line_resolve( line, &(tokens[i]) );
+    cursor = end;
+  }
+
+  /* classify from the token before the edit, until nothing changes */
+  if( a > 0 ) {
+    i = a - 1;
+    state = tokens[i].state;
+    owner = tokens[i].owner;
+  } else {
+    i = 0;
+    state = LINE_OPTIONS;
+    owner = NULL;
+  }
+  for( ; i < count; i++ ) {
+    if( i >= a + k && tokens[i].state == state && tokens[i].owner == owner ) {
+      /* from here on, all is as it was, except for the token before */
+      if( state == LINE_PARAM && tokens[i].kind != CHOICE_TOKEN_PARAM &&
+          (owner->flags & OPTION_REQARG) )
+        tokens[i - 1].error = OPTION_EREQARG;
+      return 0;
+    }
+    state = line_derive( line, i, state, owner );
+    owner = (state == LINE_PARAM) ? tokens[i].option : NULL;
+  }
+  line->state = state;
+  line->owner = owner;
+  if( state == LINE_PARAM && (owner->flags & OPTION_REQARG) )
+    tokens[count - 1].error = OPTION_EREQARG;
+  return 0;
+}
+
+/**
+ * Make the line `len` characters of `str`, as one edit between the
+ * parts it has in common with the old line.
+ */
+int choice_line_set( choice_line_t* line, const char* str, size_t len ) {
+  size_t p = 0, q = 0;
+
+  while( p < len && p < line->len && str[p] == line->text[p] )
+    p++;
+  while( q < len - p && q < line->len - p && str[len - 1 - q] == line->text[line->len - 1 - q] )
+    q++;
+  return choice_line_edit( line, p, line->len - p - q, str + p, len - p - q );
+}
+
+/** @} */
+
+/* MARK: batch parsing *//**
+ * @name batch parsing
+ * Parse many argument vectors against one table, on a pool of threads.
+ * Every job stores its values in its own record, through the offset map
+ * of the batch (see `choice_call`). Workers claim `CHOICE_BATCH_CHUNK`
+ * jobs at a time from a shared counter.
+ * @{
+ */
+
+typedef struct choice_worker_s {
+  choice_batch_t* batch;
+  choice_job_t* jobs;
+  size_t count;
+  size_t* next;
+  unsigned long failed;
+  unsigned long long args;
+} choice_worker_t;
+
+static void* choice_batch_work( void* data ) {
+  choice_worker_t* worker = data;
+  choice_parser_t parser;
+  choice_job_t* job;
+  size_t i, end;
+
+  choice_parser_init( &parser, worker->batch->table );
+  parser.offsets = worker->batch->offsets;
+
+  for( ;; ) {
+    i = __atomic_fetch_add( worker->next, CHOICE_BATCH_CHUNK, __ATOMIC_RELAXED );
+    if( i >= worker->count )
+      break;
+    end = (i + CHOICE_BATCH_CHUNK < worker->count) ? i + CHOICE_BATCH_CHUNK : worker->count;
+    for( ; i < end; i++ ) {
+      job = &(worker->jobs[i]);
+      parser.record = job->record;
+      job->error = choice_parse( &parser, job->argc, job->argv );
+      job->index = parser.index;
+      if( job->error ) {
+        memcpy( &(job->detail), &(parser.error), sizeof(job->detail) );
+        worker->failed++;
+      }
+      worker->args += (job->argc > 0) ? job->argc - 1 : 0;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Parse `count` jobs on `batch->threads` threads (at least one).
+ * Each job records its own result; the counters of `batch` are set
+ * when all jobs are done. Returns the number of jobs that failed.
+ * Without thread support (`CHOICE_NO_THREADS`), jobs run one by one.
+ * An option with `data` but no offset (`CHOICE_NO_OFFSET`, or no
+ * `offsets` at all) would be shared by every job, and so would the
+ * options of a suboption table or subcommand: then every job fails
+ * with `OPTION_EINVAL`, the option in its `detail`. Callbacks that
+ * store elsewhere than their `data` must not be used in a batch.
+ */
+size_t choice_batch_parse( choice_batch_t* batch, choice_job_t* jobs, size_t count ) {
+  choice_worker_t workers[CHOICE_BATCH_THREADS];
+  const option_table_t* table = batch->table;
+  unsigned threads = batch->threads, t;
+  struct timespec start, stop;
+  size_t next = 0, i;
+#ifndef CHOICE_NO_THREADS
+  pthread_t ids[CHOICE_BATCH_THREADS];
+#endif
+
+  batch->jobs = count;
+  batch->args = 0;
+  batch->nanoseconds = 0;
+  for( i = 0; i < table->count; i++ )
+    if( table->options[i].data != NULL &&
+        (batch->offsets == NULL || batch->offsets[i] == CHOICE_NO_OFFSET) )
+      break;
+  if( i < table->count ) {
+    for( next = 0; next < count; next++ ) {
+      jobs[next].error = OPTION_EINVAL;
+      jobs[next].index = 0;
+      memset( &(jobs[next].detail), 0, sizeof(jobs[next].detail) );
+      jobs[next].detail.code = OPTION_EINVAL;
+      jobs[next].detail.option = &(table->options[i]);
+    }
+    return batch->failed = count;
+  }
+
+  if( threads < 1 )
+    threads = 1;
+  if( threads > CHOICE_BATCH_THREADS )
+    threads = CHOICE_BATCH_THREADS;
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  for( t = 0; t < threads; t++ ) {
+    workers[t].batch = batch;
+    workers[t].jobs = jobs;
+    workers[t].count = count;
+    workers[t].next = &next;
+    workers[t].failed = 0;
+    workers[t].args = 0;
+  }
+#ifndef CHOICE_NO_THREADS
+  for( t = 1; t < threads; t++ )
+    if( pthread_create( &(ids[t]), NULL, &choice_batch_work, &(workers[t]) ) != 0 )
+      break;
+  threads = t;
+  choice_batch_work( &(workers[0]) );
+  for( t = 1; t < threads; t++ )
+    pthread_join( ids[t], NULL );
+#else
+  threads = 1;
+  choice_batch_work( &(workers[0]) );
+#endif
+  clock_gettime( CLOCK_MONOTONIC, &stop );
+
+  batch->failed = 0;
+  for( t = 0; t < threads; t++ ) {
+    batch->failed += workers[t].failed;
+    batch->args += workers[t].args;
+  }
+  batch->nanoseconds = (stop.tv_sec - start.tv_sec) * 1000000000ull
+                     + stop.tv_nsec - start.tv_nsec;
+  return batch->failed;
+}
+
+/** @} */
+
+/* MARK: parallel parsing *//**
+ * @name parallel parsing
+ * Parse one huge argument vector on many threads. Looking up the long
+ * options is the expensive part, and what a name resolves to does not
+ * depend on the arguments around it, so threads resolve the vector a
+ * chunk at a time, while the calling thread parses along behind them
+ * (helping out when it catches up). Everything that does depend on the
+ * neighbours (parameters in the next argument, `--`, groups of
+ * abbreviations, the end of the options) is left to that serial pass,
+ * which calls back in order.
+ * @{
+ */
+
+#ifndef CHOICE_NO_THREADS
+static void* choice_resolve_work( void* data ) {
+  choice_resolver_t* resolver = data;
+
+  while( !__atomic_load_n( &(resolver->stop), __ATOMIC_RELAXED ) &&
+         choice_resolve_chunk( resolver ) );
+  return NULL;
+}
+#endif
+
+/**
+ * Same as `choice_parse`, with the long options resolved on `threads`
+ * threads: callbacks, errors, `index` and positional arguments are
+ * exactly what `choice_parse` would have come up with. Short vectors,
+ * and those that can not get the memory, are parsed serially.
+ */
+int choice_parse_parallel( choice_parser_t* parser, int argc, const char* const argv[],
+                           unsigned threads ) {
+  choice_resolver_t resolver;
+  int error;
+#ifndef CHOICE_NO_THREADS
+  pthread_t ids[CHOICE_BATCH_THREADS];
+  unsigned t;
+#endif
+
+  if( threads > CHOICE_BATCH_THREADS )
+    threads = CHOICE_BATCH_THREADS;
+  if( threads < 2 || argc < 2 * CHOICE_PARALLEL_CHUNK )
+    return choice_parse( parser, argc, argv );
+
+  memset( &resolver, 0, sizeof(resolver) );
+  resolver.table = parser->table;
+  resolver.argv = argv;
+  resolver.argc = argc;
+  resolver.chunks = (argc - 1 + CHOICE_PARALLEL_CHUNK - 1) / CHOICE_PARALLEL_CHUNK;
+  resolver.resolved = calloc( argc, sizeof(*(resolver.resolved)) );
+  resolver.done = calloc( resolver.chunks, sizeof(*(resolver.done)) );
+  if( resolver.resolved == NULL || resolver.done == NULL ) {
+    free( resolver.resolved );
+    free( resolver.done );
+    return choice_parse( parser, argc, argv );
+  }
+
+#ifndef CHOICE_NO_THREADS
+  for( t = 1; t < threads; t++ )
+    if( pthread_create( &(ids[t]), NULL, &choice_resolve_work, &resolver ) != 0 )
+      break;
+  threads = t;
+#endif
+  error = choice_parse_resolved( parser, argc, argv, &resolver );
+  __atomic_store_n( &(resolver.stop), true, __ATOMIC_RELAXED );
+#ifndef CHOICE_NO_THREADS
+  for( t = 1; t < threads; t++ )
+    pthread_join( ids[t], NULL );
+#endif
+
+  free( resolver.resolved );
+  free( resolver.done );
+  return error;
+}
+
+/** @} */
+
+/* MARK: streaming *//**
+ * @name streaming
+ * Parse arguments that arrive as a stream of NUL terminated strings
+ * (like the output of `find -print0`), in chunks of any size, for as
+ * long as the stream goes on. Arguments that are whole within a chunk
+ * are parsed right there; only the start of an argument cut off by the
+ * end of a chunk is kept, in a buffer of `CHOICE_STREAM_MAX` bytes.
+ * There is no end to look ahead to, so options are parsed past
+ * positional arguments (and errors), and an option that may take the
+ * next argument as its parameter is called back once that has come.
+ * @{
+ */
+
+/**
+ * Whether `option` keeps its parameter (`option_str`, `option_strs`)
+ * or writes into it (`option_subopt`, `option_subtable`), which would
+ * leave it pointing into a chunk that is gone with the next push.
+ */
+static bool stream_keeps( const option_t* option ) {
+  return option->callback == &option_str || option->callback == &option_strs ||
+         option->callback == &option_subopt || option->callback == &option_subtable;
+}
+
+/**
+ * Prepare `stream` to parse against the compiled `table`. Set
+ * `positional` to an option (taking a parameter) to be called back
+ * with the arguments that are not options. Returns 0,
+ * `OPTION_ENOMEM`, or `OPTION_EINVAL` (with the option in
+ * `parser.error`) if `table` has an option `stream_keeps`.
+ */
+int choice_stream_init( choice_stream_t* stream, const option_table_t* table ) {
+  unsigned i;
+
+  memset( stream, 0, sizeof(*stream) );
+  choice_parser_init( &(stream->parser), table );
+  for( i = 0; i < table->count; i++ )
+    if( stream_keeps( &(table->options[i]) ) )
+      return choice_fail( &(stream->parser), OPTION_EINVAL, &(table->options[i]), NULL, 0, 0 );
+  if( (stream->buffer = malloc( CHOICE_STREAM_MAX )) == NULL )
+    return OPTION_ENOMEM;
+  return 0;
+}
+
+/** Release the buffer of `stream`. */
+void choice_stream_free( choice_stream_t* stream ) {
+  free( stream->buffer );
+  stream->buffer = NULL;
+}
+
+/** The index of the current argument, as far as an `int` goes. */
+static int stream_index( const choice_stream_t* stream ) {
+  return (stream->args < INT_MAX) ? (int) stream->args : INT_MAX;
+}
+
+/** Count the error of an argument, if there is one. */
+static void stream_check( choice_stream_t* stream, int error ) {
+  if( error )
+    stream->errors++;
+}
+
+/**
+ * Parse the complete argument `arg`, after giving the option that
+ * waits for a parameter what it gets.
+ */
+static void stream_arg( choice_stream_t* stream, const char* arg ) {
+  choice_parser_t* parser = &(stream->parser);
+  option_t* option = stream->pending;
+  const char* value;
+  unsigned index;
+  int i;
+
+  stream->args++;
+  i = stream_index( stream );
+  if( option != NULL ) {
+    stream->pending = NULL;
+    if( arg[0] != '-' || ((option->flags & OPTION_REQARG) && arg[1] == '\0') ) {
+      stream_check( stream, choice_invoke( parser, option, arg, i ) );
+      return;
+    }
+    stream_check( stream, choice_invoke( parser, option, NULL, i - 1 ) );
+  }
+
+  if( stream->rest || arg[0] != '-' || arg[1] == '\0' ) {
+    if( stream->positional == NULL )
+      stream_check( stream, choice_fail( parser, OPTION_EINVAL, NULL, arg, strlen( arg ), i ) );
+    else
+      stream_check( stream, choice_invoke( parser, stream->positional, arg, i ) );
+  } else if( arg[1] == '-' && arg[2] == '\0' ) {
+    /* "--" */
+    stream->rest = true;
+  } else if( arg[1] == '-' ) {
+    arg += 2;
+    value = strchrnul( (char*) arg, '=' );
+    if( (option = choice_lookup( parser, parser->table, 0, arg, value - arg, i )) == NULL ) {
+      stream_check( stream, parser->error.code );
+      return;
+    }
+    if( *value == '=' )
+      value++;
+    if( *value != '\0' )
+      stream_check( stream, choice_invoke( parser, option, value, i ) );
+    else if( option->flags & OPTION_ARG )
+      stream->pending = option;
+    else
+      stream_check( stream, choice_invoke( parser, option, NULL, i ) );
+  } else {
+    for( arg++; *arg != '\0'; arg++ ) {
+      if( (index = parser->table->abbr[(unsigned char) *arg]) == 0 ) {
+        stream_check( stream, choice_fail( parser, OPTION_EINVAL, NULL, arg, 1, i ) );
+        return;
+      }
+      option = &(parser->table->options[index - 1]);
+      if( !(option->flags & OPTION_ARG) ) {
+        if( choice_invoke( parser, option, NULL, i ) ) {
+          stream_check( stream, parser->error.code );
+          return;
+        }
+      } else if( arg[1] != '\0' ) {
+        stream_check( stream, choice_invoke( parser, option, arg + 1, i ) );
+        return;
+      } else {
+        stream->pending = option;
+        return;
+      }
+    }
+  }
+}
+
+/**
+ * Feed `len` bytes of the stream to `stream`, calling back as the
+ * arguments in them are complete. An argument in error is dropped and
+ * the stream goes on; `errors` counts them, and `parser.error` tells
+ * about the last one (its `arg` is only good until the next push).
+ * Arguments that have to be carried over and do not fit the buffer
+ * fail with `OPTION_ENOMEM`. Callbacks of your own that keep their
+ * parameter have to copy it (a `positional` the stream `stream_keeps`
+ * fails with `OPTION_EINVAL`), and `defer` does not work here.
+ * Returns 0, or the code of the last error among these bytes.
+ */
+int choice_stream_push( choice_stream_t* stream, const char* data, size_t len ) {
+  unsigned long long errors = stream->errors;
+  const char* nul;
+  size_t n;
+
+  if( stream->positional != NULL && stream_keeps( stream->positional ) )
+    return choice_fail( &(stream->parser), OPTION_EINVAL, stream->positional, NULL, 0,
+                        stream_index( stream ) );
+  while( len > 0 ) {
+    nul = memchr( data, '\0', len );
+    n = (nul != NULL) ? (size_t) (nul - data) : len;
+
+    /* carry the start of an argument over to the next chunk */
+    if( !stream->overflow && (nul == NULL || stream->len > 0) ) {
+      if( stream->len + n < CHOICE_STREAM_MAX ) {
+        memcpy( stream->buffer + stream->len, data, n );
+        stream->len += n;
+      } else {
+        stream->overflow = true;
+        stream->len = 0;
+      }
+    }
+    if( nul == NULL )
+      break;
+
+    if( stream->overflow ) {
+      stream->args++;
+      stream_check( stream, choice_fail( &(stream->parser), OPTION_ENOMEM, NULL, NULL, 0,
+                                         stream_index( stream ) ) );
+    } else if( stream->len > 0 ) {
+      stream->buffer[stream->len] = '\0';
+      stream_arg( stream, stream->buffer );
+    } else {
+      stream_arg( stream, data );
+    }
+    stream->overflow = false;
+    stream->len = 0;
+    data += n + 1;
+    len -= n + 1;
+  }
+  return (stream->errors != errors) ? stream->parser.error.code : 0;
+}
+
+/**
+ * End the stream: an argument without its NUL still counts, and an
+ * option still waiting for a parameter goes without. Returns 0, or
+ * the code of the last error.
+ */
+int choice_stream_end( choice_stream_t* stream ) {
+  unsigned long long errors = stream->errors;
+  option_t* option;
+
+  if( stream->len > 0 || stream->overflow )
+    choice_stream_push( stream, "", 1 );
+  if( (option = stream->pending) != NULL ) {
+    stream->pending = NULL;
+    stream_check( stream, choice_invoke( &(stream->parser), option, NULL, stream_index( stream ) ) );
+  }
+  stream->ended = true;
+  return (stream->errors != errors) ? stream->parser.error.code : 0;
+}
+
+/**
+ * Feed what can be read from `fd` to `stream`, `CHOICE_STREAM_CHUNK`
+ * bytes at a time, until the end of the file (which ends the stream)
+ * or until a non-blocking `fd` has nothing more for now. Returns 0,
+ * the code of the last error, or `OPTION_EFILE` if `fd` can not be read.
+ */
+int choice_stream_fd( choice_stream_t* stream, int fd ) {
+  unsigned long long errors = stream->errors;
+  char chunk[CHOICE_STREAM_CHUNK];
+  ssize_t n;
+
+  for( ;; ) {
+    if( (n = read( fd, chunk, sizeof(chunk) )) > 0 )
+      choice_stream_push( stream, chunk, n );
+    else if( n == 0 )
+      choice_stream_end( stream );
+    else if( errno == EINTR )
+      continue;
+    else if( errno != EAGAIN && errno != EWOULDBLOCK )
+      return choice_fail( &(stream->parser), OPTION_EFILE, NULL, NULL, 0, stream_index( stream ) );
+    if( n <= 0 )
+      return (stream->errors != errors) ? stream->parser.error.code : 0;
+  }
+}
+
+/** @} */
+
+/* MARK: deferred callbacks *//**
+ * @name deferred callbacks
+ * A parser with `defer` set only records the callbacks it would call.
+ * `choice_defer_run` then calls them on a pool of threads, as soon as
+ * the events they depend on are done: the previous event of the same
+ * option, the previous event storing to the same place (like `--color`
+ * and `--no-color` on one `bool`), the previous `OPTION_ORDERED` event
+ * (for ordered options), and the last event of every option declared
+ * in `after`. All events
+ * run (or fail), so every error is collected, not just the first one.
+ * @{
+ */
+
+#ifndef CHOICE_NO_THREADS
+#define defer_lock(run) pthread_mutex_lock( &(run)->lock )
+#define defer_unlock(run) pthread_mutex_unlock( &(run)->lock )
+#define defer_wait(run) pthread_cond_wait( &(run)->done, &(run)->lock )
+#define defer_wake(run) pthread_cond_broadcast( &(run)->done )
+#else
+#define defer_lock(run) ((void) 0)
+#define defer_unlock(run) ((void) 0)
+#define defer_wait(run) ((void) 0)
+#define defer_wake(run) ((void) 0)
+#endif
+
+/**
+ * The dependency graph of one `choice_defer_run`: the events that
+ * wait for event `e` are `targets[offsets[e]]` up to (not including)
+ * `targets[offsets[e+1]]`, `hard` if a failure is passed on to them.
+ * Events are queued as they become ready.
+ */
+typedef struct defer_run_s {
+  choice_parser_t* parser;
+  choice_defer_t* defer;
+  size_t* offsets;
+  size_t* targets;
+  bool* hard;
+  size_t* queue;
+  size_t head;
+  size_t tail;
+  size_t remaining;
+  unsigned running;
+#ifndef CHOICE_NO_THREADS
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+#endif
+} defer_run_t;
+
+/**
+ * Find the slot of `key` (an option, or where it stores) in the open
+ * addressed map of `mask` + 1 slots, which holds the last event of
+ * each key (plus one).
+ */
+static size_t defer_slot( const void** keys, size_t mask, const void* key ) {
+  size_t slot = choice_hash( (const char*) &key, sizeof(key), 0 ) & mask;
+
+  while( keys[slot] != NULL && keys[slot] != key )
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+/**
+ * Add the edge `from` -> `to`, or (if `targets` is not there yet) just
+ * count it.
+ */
+static void defer_edge( defer_run_t* run, size_t* fill, size_t from, size_t to, bool hard ) {
+  run->defer->events[to].pending++;
+  if( run->targets == NULL ) {
+    run->offsets[from + 1]++;
+  } else {
+    run->targets[fill[from]] = to;
+    run->hard[fill[from]++] = hard;
+  }
+}
+
+/**
+ * Walk the events and add their dependencies: once to count them, once
+ * to fill them in. Returns `false` when out of memory.
+ */
+static bool defer_graph( defer_run_t* run, size_t* fill ) {
+  choice_defer_t* defer = run->defer;
+  choice_event_t* events = defer->events;
+  const void** keys;
+  const void** targets;
+  size_t* last;
+  size_t* stores;
+  size_t mask, slot, e, a, before, ordered = 0;
+  void* target;
+
+  for( mask = 1; mask < 2 * defer->count; mask <<= 1 );
+  keys = calloc( mask, sizeof(*keys) );
+  last = calloc( mask, sizeof(*last) );
+  targets = calloc( mask, sizeof(*targets) );
+  stores = calloc( mask, sizeof(*stores) );
+  if( keys == NULL || last == NULL || targets == NULL || stores == NULL ) {
+    free( keys );
+    free( last );
+    free( targets );
+    free( stores );
+    return false;
+  }
+  mask--;
+
+  for( e = 0; e < defer->count; e++ ) {
+    events[e].pending = 0;
+    slot = defer_slot( keys, mask, events[e].option );
+    before = last[slot];
+    if( before > 0 )
+      defer_edge( run, fill, before - 1, e, false );
+    keys[slot] = events[e].option;
+    last[slot] = e + 1;
+    /* another option storing to the same place, unless that was this one */
+    if( (target = choice_target( run->parser, events[e].option )) != NULL ) {
+      slot = defer_slot( targets, mask, target );
+      if( stores[slot] > 0 && stores[slot] != before )
+        defer_edge( run, fill, stores[slot] - 1, e, false );
+      targets[slot] = target;
+      stores[slot] = e + 1;
+    }
+    if( events[e].option->flags & OPTION_ORDERED ) {
+      if( ordered > 0 )
+        defer_edge( run, fill, ordered - 1, e, false );
+      ordered = e + 1;
+    }
+  }
+  for( e = 0; e < defer->count; e++ ) {
+    for( a = 0; a < defer->afters; a++ ) {
+      if( defer->after[a].option != events[e].option || defer->after[a].after == events[e].option )
+        continue;
+      slot = defer_slot( keys, mask, defer->after[a].after );
+      if( keys[slot] != NULL )
+        defer_edge( run, fill, last[slot] - 1, e, true );
+    }
+  }
+  free( keys );
+  free( last );
+  free( targets );
+  free( stores );
+  return true;
+}
+
+/**
+ * Take ready events off the queue and call them back, until there are
+ * none left. If nothing is ready and nothing is running, the remaining
+ * events wait for each other in a circle, and fail.
+ */
+static void* defer_work( void* data ) {
+  defer_run_t* run = data;
+  choice_event_t* events = run->defer->events;
+  choice_event_t* event;
+  size_t e, t;
+  int error;
+
+  defer_lock( run );
+  for( ;; ) {
+    while( run->head == run->tail && run->remaining > 0 && run->running > 0 )
+      defer_wait( run );
+    if( run->remaining == 0 )
+      break;
+    if( run->head == run->tail ) {
+      for( e = 0; e < run->defer->count; e++ )
+        if( events[e].pending > 0 )
+          events[e].error = OPTION_EDEPEND;
+      run->remaining = 0;
+      defer_wake( run );
+      break;
+    }
+    e = run->queue[run->head++];
+    event = &(events[e]);
+    run->running++;
+    defer_unlock( run );
+
+    error = event->blocked ? OPTION_EDEPEND : choice_call( run->parser, event->option, event->arg );
+
+    defer_lock( run );
+    event->error = error;
+    for( t = run->offsets[e]; t < run->offsets[e + 1]; t++ ) {
+      if( error != 0 && run->hard[t] )
+        events[run->targets[t]].blocked = true;
+      if( --events[run->targets[t]].pending == 0 )
+        run->queue[run->tail++] = run->targets[t];
+    }
+    run->running--;
+    run->remaining--;
+    defer_wake( run );
+  }
+  defer_unlock( run );
+  return NULL;
+}
+
+/**
+ * Call back the events recorded in `defer`, storing through `parser`
+ * (and its offset map) like the parse would have. Returns the number
+ * of events that failed, each with its own `error`; the first of them
+ * (in the order of the arguments) is recorded in `parser->error`.
+ */
+size_t choice_defer_run( choice_parser_t* parser, choice_defer_t* defer ) {
+  unsigned threads = defer->threads;
+  defer_run_t run;
+  size_t* fill;
+  size_t e;
+  bool ok;
+#ifndef CHOICE_NO_THREADS
+  pthread_t ids[CHOICE_BATCH_THREADS];
+  unsigned t;
+#endif
+
+  defer->failed = 0;
+  if( defer->count == 0 )
+    return 0;
+
+  memset( &run, 0, sizeof(run) );
+  run.parser = parser;
+  run.defer = defer;
+  run.remaining = defer->count;
+  run.offsets = calloc( defer->count + 1, sizeof(*(run.offsets)) );
+  run.queue = malloc( defer->count * sizeof(*(run.queue)) );
+  fill = malloc( defer->count * sizeof(*fill) );
+  ok = run.offsets != NULL && run.queue != NULL && fill != NULL && defer_graph( &run, fill );
+  if( ok ) {
+    for( e = 0; e < defer->count; e++ )
+      run.offsets[e + 1] += run.offsets[e];
+    memcpy( fill, run.offsets, defer->count * sizeof(*fill) );
+    run.targets = malloc( (run.offsets[defer->count] + 1) * sizeof(*(run.targets)) );
+    run.hard = malloc( run.offsets[defer->count] + 1 );
+    ok = run.targets != NULL && run.hard != NULL && defer_graph( &run, fill );
+  }
+
+  if( ok ) {
+    for( e = 0; e < defer->count; e++ ) {
+      defer->events[e].error = 0;
+      defer->events[e].blocked = false;
+      if( defer->events[e].pending == 0 )
+        run.queue[run.tail++] = e;
+    }
+
+    if( threads < 1 )
+      threads = 1;
+    if( threads > CHOICE_BATCH_THREADS )
+      threads = CHOICE_BATCH_THREADS;
+    if( threads > defer->count )
+      threads = defer->count;
+#ifndef CHOICE_NO_THREADS
+    pthread_mutex_init( &run.lock, NULL );
+    pthread_cond_init( &run.done, NULL );
+    for( t = 1; t < threads; t++ )
+      if( pthread_create( &(ids[t]), NULL, &defer_work, &run ) != 0 )
+        break;
+    threads = t;
+    defer_work( &run );
+    for( t = 1; t < threads; t++ )
+      pthread_join( ids[t], NULL );
+    pthread_cond_destroy( &run.done );
+    pthread_mutex_destroy( &run.lock );
+#else
+    defer_work( &run );
+#endif
+  } else {
+    for( e = 0; e < defer->count; e++ )
+      defer->events[e].error = OPTION_ENOMEM;
+  }
+  free( run.offsets );
+  free( run.targets );
+  free( run.hard );
+  free( run.queue );
+  free( fill );
+
+  for( e = defer->count; e-- > 0; ) {
+    if( defer->events[e].error != 0 ) {
+      choice_fail( parser, defer->events[e].error, defer->events[e].option, defer->events[e].arg,
+                   (defer->events[e].arg != NULL) ? strlen( defer->events[e].arg ) : 0,
+                   defer->events[e].index );
+      defer->failed++;
+    }
+  }
+  return defer->failed;
+}
+
+/** Forget the events of `defer`, and the parameters copied for them. */
+void choice_defer_free( choice_defer_t* defer ) {
+  char* copy;
+
+  while( (copy = defer->copies) != NULL ) {
+    memcpy( &(defer->copies), copy, sizeof(char*) );
+    free( copy );
+  }
+  free( defer->events );
+  defer->events = NULL;
+  defer->count = 0;
+  defer->capacity = 0;
+  defer->failed = 0;
+}
+
+/** @} */
+
+/* MARK: configuration *//**
+ * @name configuration
+ * Options from a config file and an environment variable, sent through
+ * the same table and callbacks as the arguments. Every option remembers
+ * the source of its value (`CHOICE_SOURCE_*`): the arguments override
+ * the environment, which overrides the file, in whatever order they are
+ * loaded. The file is made of lines of `key = value` (or `key value`,
+ * or just `key` for options without a parameter); keys are resolved
+ * like long options, blank lines and lines starting with `#` or `;` are
+ * skipped, and quotes around a value are dropped. An option given more
+ * than once keeps the last value, unless it is `OPTION_MULTIPLE`.
+ * @{
+ */
+
+/**
+ * The value of one option in the file, as last seen: the parameters,
+ * each terminated (one after another, for `OPTION_MULTIPLE`), and the
+ * line they came from. `text` is `NULL` if the key was never given,
+ * and `failed` if calling back failed (so the next reload tries again).
+ */
+struct choice_value_s {
+  char* text;
+  size_t len;
+  int line;
+  bool failed;
+};
+
+/**
+ * Prepare `config` to load options into the compiled `table`.
+ * Load the sources with `choice_config_file`, `choice_config_env` and
+ * `choice_config_argv`, release it with `choice_config_free`.
+ * Returns 0 or `OPTION_ENOMEM`.
+ */
+int choice_config_init( choice_config_t* config, const option_table_t* table ) {
+  memset( config, 0, sizeof(*config) );
+  choice_parser_init( &(config->parser), table );
+  config->sources = calloc( table->count + 1, sizeof(*(config->sources)) );
+  config->values = calloc( table->count + 1, sizeof(*(config->values)) );
+  if( config->sources == NULL || config->values == NULL ) {
+    choice_config_free( config );
+    return OPTION_ENOMEM;
+  }
+  config->parser.sources = config->sources;
+  return 0;
+}
+
+/**
+ * Map the file at `path` read-only. An empty file maps to nothing.
+ * Returns `false` if it can not be read.
+ */
+static bool config_map( const char* path, const char** text, size_t* size ) {
+  struct stat st;
+  void* base = NULL;
+  int fd;
+
+  if( (fd = open( path, O_RDONLY )) < 0 )
+    return false;
+  if( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) ||
+      (st.st_size > 0 &&
+       (base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED) ) {
+    close( fd );
+    return false;
+  }
+  close( fd );
+  *text = base;
+  *size = st.st_size;
+  return true;
+}
+
+/**
+ * Add `len` characters of `value`, from `line`, to the parameters of
+ * an option. Returns `false` when out of memory.
+ */
+static bool config_add( struct choice_value_s* value, const option_t* option,
+                        const char* str, size_t len, int line ) {
+  size_t at = (option->flags & OPTION_MULTIPLE) ? value->len : 0;
+  char* text = realloc( value->text, at + len + 1 );
+
+  if( text == NULL )
+    return false;
+  memcpy( text + at, str, len );
+  text[at + len] = '\0';
+  value->text = text;
+  value->len = at + len + 1;
+  value->line = line;
+  return true;
+}
+
+/**
+ * Cut the mapped file into keys and values, and collect the values
+ * of every option in `values`. Nothing is called back yet, so a
+ * file with unknown keys changes nothing.
+ */
+static int config_read( choice_config_t* config, struct choice_value_s* values ) {
+  choice_parser_t* parser = &(config->parser);
+  const char* pos = config->text;
+  const char* end = pos + config->size;
+  const char *eol, *key, *str;
+  option_t* option;
+  size_t klen;
+  int line;
+
+  for( line = 1; pos < end; pos = eol + 1, line++ ) {
+    if( (eol = memchr( pos, '\n', end - pos )) == NULL )
+      eol = end;
+    while( pos < eol && isspace( (unsigned char) *pos ) )
+      pos++;
+    if( pos == eol || *pos == '#' || *pos == ';' )
+      continue;
+
+    for( key = pos; pos < eol && *pos != '=' && !isspace( (unsigned char) *pos ); pos++ );
+    klen = pos - key;
+    while( pos < eol && isspace( (unsigned char) *pos ) )
+      pos++;
+    if( pos < eol && *pos == '=' )
+      pos++;
+    while( pos < eol && isspace( (unsigned char) *pos ) )
+      pos++;
+    for( str = eol; str > pos && isspace( (unsigned char) str[-1] ); str-- );
+    if( str - pos >= 2 && (*pos == '"' || *pos == '\'') && str[-1] == *pos ) {
+      pos++;
+      str--;
+    }
+
+    if( (option = choice_lookup( parser, parser->table, 0, key, klen, line )) == NULL )
+      return parser->error.code;
+    if( !config_add( &(values[option - parser->table->options]), option, pos, str - pos, line ) )
+      return choice_fail( parser, OPTION_ENOMEM, option, key, klen, line );
+  }
+  return 0;
+}
+
+/**
+ * Call back every option whose parameters in `values` differ from what
+ * was loaded before, unless a higher source has set it. The new values
+ * replace the old ones either way; keys that are gone keep theirs.
+ */
+static int config_apply( choice_config_t* config, struct choice_value_s* values ) {
+  choice_parser_t* parser = &(config->parser);
+  const option_table_t* table = parser->table;
+  struct choice_value_s* old;
+  option_t* option;
+  const char* arg;
+  unsigned i;
+  int error = 0;
+
+  for( i = 0; i < table->count; i++ ) {
+    old = &(config->values[i]);
+    if( values[i].text == NULL )
+      continue;
+    if( !old->failed && old->text != NULL && old->len == values[i].len &&
+        memcmp( old->text, values[i].text, old->len ) == 0 ) {
+      free( values[i].text );
+      old->line = values[i].line;
+      continue;
+    }
+    /* after an error, the rest keep their old values, to be applied next time */
+    if( error != 0 ) {
+      free( values[i].text );
+      continue;
+    }
+
+    option = &(table->options[i]);
+    if( config->sources[i] <= CHOICE_SOURCE_FILE ) {
+      config->sources[i] = CHOICE_SOURCE_FILE;
+      choice_list_reset( option );
+      for( arg = values[i].text; error == 0 && arg < values[i].text + values[i].len;
+           arg += strlen( arg ) + 1 )
+        error = choice_invoke( parser, option, arg, values[i].line );
+      /* callbacks may point into it already, so it is kept all the same */
+      values[i].failed = (error != 0);
+      config->changed++;
+    }
+    free( old->text );
+    memcpy( old, &(values[i]), sizeof(*old) );
+  }
+  return error;
+}
+
+/**
+ * Load options from the config file at `path`, which is remembered for
+ * `choice_config_reload`. Returns 0 or an error code, see `parser`.
+ */
+int choice_config_file( choice_config_t* config, const char* path ) {
+  config->path = path;
+  return choice_config_reload( config );
+}
+
+/**
+ * Read the config file again and call back only the options whose
+ * values changed, and that neither the environment nor the arguments
+ * have set. A file that can not be read or has unknown keys changes
+ * nothing. Signal handlers should not call this themselves, but have
+ * the program do so (on `SIGHUP`, say) when it gets around to it.
+ */
+int choice_config_reload( choice_config_t* config ) {
+  choice_parser_t* parser = &(config->parser);
+  struct choice_value_s* values;
+  const char* text;
+  size_t size;
+  unsigned i;
+  int error;
+
+  config->changed = 0;
+  if( config->path == NULL )
+    return 0;
+  if( !config_map( config->path, &text, &size ) )
+    return choice_fail( parser, OPTION_EFILE, NULL, config->path, strlen( config->path ), 0 );
+  if( config->text != NULL )
+    munmap( (void*) config->text, config->size );
+  config->text = text;
+  config->size = size;
+
+  if( (values = calloc( parser->table->count + 1, sizeof(*values) )) == NULL )
+    return choice_fail( parser, OPTION_ENOMEM, NULL, NULL, 0, 0 );
+  parser->source = CHOICE_SOURCE_FILE;
+  if( (error = config_read( config, values )) == 0 ) {
+    error = config_apply( config, values );
+  } else {
+    for( i = 0; i < parser->table->count; i++ )
+      free( values[i].text );
+  }
+  free( values );
+  return error;
+}
+
+/**
+ * Load options from the environment variable `name`, which holds them
+ * like the arguments would, split up like a response file. Options are
+ * all it may hold. Returns 0 or an error code, see `parser`.
+ */
+int choice_config_env( choice_config_t* config, const char* name ) {
+  choice_parser_t* parser = &(config->parser);
+  const char* str = getenv( name );
+  const char** argv = NULL;
+  const char** grow;
+  response_t file;
+  char* copy;
+  size_t len;
+  int argc = 1, error = 0;
+
+  if( str == NULL || *str == '\0' )
+    return 0;
+  /* callbacks keep pointers into the copy, so it lives as long as `config` */
+  len = strlen( str );
+  if( (copy = malloc( sizeof(char*) + len + 1 )) == NULL )
+    return choice_fail( parser, OPTION_ENOMEM, NULL, NULL, 0, 0 );
+  memcpy( copy, &(config->env), sizeof(char*) );
+  memcpy( copy + sizeof(char*), str, len + 1 );
+  config->env = copy;
+
+  file.pos = copy + sizeof(char*);
+  file.end = file.pos + len;
+  do {
+    if( (argc & (argc - 1)) == 0 ) {
+      if( (grow = realloc( argv, 2 * argc * sizeof(*argv) )) == NULL ) {
+        free( argv );
+        return choice_fail( parser, OPTION_ENOMEM, NULL, NULL, 0, 0 );
+      }
+      argv = grow;
+    }
+  } while( (argv[argc++] = response_next( &file )) != NULL );
+  argv[0] = name;
+
+  parser->source = CHOICE_SOURCE_ENV;
+  if( (error = choice_parse( parser, argc - 1, argv )) == 0 && parser->index < argc - 1 )
+    error = choice_fail( parser, OPTION_EINVAL, NULL, argv[parser->index],
+                         strlen( argv[parser->index] ), parser->index );
+  free( argv );
+  return error;
+}
+
+/**
+ * Parse the arguments, like `choice_parse`, overriding the file and the
+ * environment. Positional arguments start at `config->parser.index`.
+ */
+int choice_config_argv( choice_config_t* config, int argc, const char* const argv[] ) {
+  config->parser.source = CHOICE_SOURCE_ARGV;
+  return choice_parse( &(config->parser), argc, argv );
+}
+
+/**
+ * Release everything `config` holds. Values that callbacks stored from
+ * the file or the environment are gone, too.
+ */
+void choice_config_free( choice_config_t* config ) {
+  char* env;
+  unsigned i;
+
+  if( config->values != NULL ) {
+    for( i = 0; i < config->parser.table->count; i++ )
+      free( config->values[i].text );
+  }
+  while( (env = config->env) != NULL ) {
+    memcpy( &(config->env), env, sizeof(char*) );
+    free( env );
+  }
+  if( config->text != NULL )
+    munmap( (void*) config->text, config->size );
+  free( config->values );
+  free( config->sources );
+  memset( config, 0, sizeof(*config) );
+}
+
+/** @} */
+
+/* MARK: statistics *//**
+ * @name statistics
+ * @{
+ */
+
+/**
+ * Copy the counters into `out` (if set) and, if `reset`, start over.
+ * Returns `false` (and zeros) unless the library was compiled with
+ * `CHOICE_STATS`, which is what it costs: nothing otherwise.
+ */
+bool choice_stats( choice_stats_t* out, bool reset ) {
+#ifdef CHOICE_STATS
+  unsigned long long* counters = (unsigned long long*) &stats;
+  unsigned long long* copy = (unsigned long long*) out;
+  size_t i;
+
+  for( i = 0; i < sizeof(stats) / sizeof(*counters); i++ ) {
+    if( reset && copy != NULL )
+      copy[i] = __atomic_exchange_n( &counters[i], 0, __ATOMIC_RELAXED );
+    else if( reset )
+      __atomic_store_n( &counters[i], 0, __ATOMIC_RELAXED );
+    else if( copy != NULL )
+      copy[i] = __atomic_load_n( &counters[i], __ATOMIC_RELAXED );
+  }
+  return true;
+#else
+  if( out != NULL )
+    memset( out, 0, sizeof(*out) );
+  return false;
+#endif
+}
+
+/**
+ * Have `hook` called with `context` as each argument begins and ends
+ * (`NULL` to stop). Set it before parsing; batches call it from many
+ * threads. Returns `false` unless compiled with `CHOICE_STATS`.
+ */
+bool choice_trace( choice_trace_cb hook, void* context ) {
+#ifdef CHOICE_STATS
+  trace_hook = hook;
+  trace_context = context;
+  return true;
+#else
+  return false;
+#endif
+}
+
+/** @} */
+
+/* MARK: completion *//**
+ * @name completion
+ * Turn a partial command line into candidates for its last word.
+ * Earlier words select the options in effect: subcommands descend into
+ * their options, and the parameter of a suboption option completes
+ * suboption names (after the last comma). Candidates are ranked with
+ * prefix matches (`choice_prefixcmp`) first, shortest completion first,
+ * then fuzzy matches (`choice_fuzzycmp`), closest first.
+ * @{
+ */
+
+/** The options below `option`, if it is a subcommand or takes suboptions. */
+static option_t* option_children( const option_t* option ) {
+  if( option->callback == &option_command || option->callback == &option_subopt )
+    return option->data;
+  if( option->callback == &option_subtable )
+    return ((option_table_t*) option->data)->options;
+  return NULL;
+}
+
+/** Find a (dash or `nodash`) option named exactly `len` characters of `str`. */
+static option_t* complete_find( option_t* options, bool nodash, const char* str, size_t len ) {
+  for( ; options->name != NULL || options->abbr != '\0'; options++ ) {
+    if( options->name != NULL && ((options->flags & OPTION_NODASH) != 0) == nodash &&
+        strncmp( options->name, str, len ) == 0 && options->name[len] == '\0' )
+      return options;
+  }
+  return NULL;
+}
+
+/** Find a dash option by abbreviation. */
+static option_t* complete_abbr( option_t* options, char c ) {
+  for( ; options->name != NULL || options->abbr != '\0'; options++ )
+    if( options->abbr == c && !(options->flags & OPTION_NODASH) )
+      return options;
+  return NULL;
+}
+
+/** Does `a` rank before `b`? */
+static bool complete_before( const choice_completion_t* a, const choice_completion_t* b ) {
+  if( a->fuzzy != b->fuzzy )
+    return !a->fuzzy;
+  if( a->score != b->score )
+    return a->score < b->score;
+  return a->option < b->option;
+}
+
+/** Rank `candidate` into the `n` of at most `max` completions. */
+static int complete_add( choice_completion_t* out, int n, int max, const choice_completion_t* candidate ) {
+  int j;
+
+  if( n == max && !complete_before( candidate, &(out[n-1]) ) )
+    return n;
+  for( j = (n < max) ? n++ : n - 1; j > 0 && complete_before( candidate, &(out[j-1]) ); j-- )
+    out[j] = out[j-1];
+  out[j] = *candidate;
+  return n;
+}
+
+/**
+ * Complete `len` characters of `str` against the (dash or `nodash`)
+ * names of `options`. Every candidate is to be preceded by `lead`.
+ */
+static int complete_names( option_t* options, bool nodash, const char* lead, size_t llen,
+                           const char* str, size_t len, choice_completion_t* out, int max ) {
+  char word[CHOICE_VALUE_MAX];
+  choice_completion_t candidate;
+  int n = 0;
+
+  if( len >= sizeof(word) )
+    return 0;
+  memcpy( word, str, len );
+  word[len] = '\0';
+
+  candidate.lead = lead;
+  candidate.len = llen;
+  for( ; options->name != NULL || options->abbr != '\0'; options++ ) {
+    if( options->name == NULL || ((options->flags & OPTION_NODASH) != 0) != nodash )
+      continue;
+    candidate.option = options;
+    if( (candidate.score = choice_prefixcmp( options->name, word )) >= 0 ) {
+      candidate.fuzzy = false;
+      n = complete_add( out, n, max, &candidate );
+    } else if( len > 0 && (candidate.score = choice_fuzzycmp( options->name, word )) >= 0 ) {
+      candidate.fuzzy = true;
+      n = complete_add( out, n, max, &candidate );
+    }
+  }
+  return n;
+}
+
+/** Complete the suboption after the last comma of `str`, if it has no parameter yet. */
+static int complete_subopts( option_t* options, const char* lead, const char* str,
+                             choice_completion_t* out, int max ) {
+  const char* item = strrchr( str, ',' );
+
+  item = (item != NULL) ? item + 1 : str;
+  if( strchr( item, '=' ) != NULL )
+    return 0;
+  return complete_names( options, true, lead, item - lead, item, strlen( item ), out, max );
+}
+
+/**
+ * Complete the last of `argc` words in `argv` (the first is the program)
+ * against `table`. Stores up to `max` ranked candidates in `out` and
+ * returns their number.
+ */
+int choice_complete( const option_table_t* table, int argc, const char* const argv[],
+                     choice_completion_t* out, int max ) {
+  option_t* options = table->options;
+  option_t* option;
+  option_t* pending = NULL;
+  option_t* children;
+  const char* word;
+  const char* eq;
+  bool positional = false;
+  int i;
+
+  if( argc < 2 || max <= 0 )
+    return 0;
+
+  for( i = 1; i < argc - 1; i++ ) {
+    word = argv[i];
+    if( pending != NULL ) {
+      pending = NULL;
+    } else if( positional ) {
+      continue;
+    } else if( strcmp( word, "--" ) == 0 ) {
+      positional = true;
+    } else if( word[0] == '-' && word[1] == '-' ) {
+      eq = strchrnul( (char*) word + 2, '=' );
+      option = complete_find( options, false, word + 2, eq - word - 2 );
+      if( option != NULL && *eq == '\0' && (option->flags & OPTION_REQARG) )
+        pending = option;
+    } else if( word[0] == '-' ) {
+      /* the first abbreviation that takes a parameter ends the group */
+      for( word++; *word != '\0'; word++ ) {
+        option = complete_abbr( options, *word );
+        if( option != NULL && (option->flags & OPTION_ARG) ) {
+          if( word[1] == '\0' && (option->flags & OPTION_REQARG) )
+            pending = option;
+          break;
+        }
+      }
+    } else if( (option = complete_find( options, true, word, strlen( word ) )) != NULL &&
+               option->callback == &option_command ) {
+      options = option->data;
+    }
+  }
+
+  word = argv[argc - 1];
+  if( pending != NULL ) {
+    children = option_children( pending );
+    if( children == NULL || pending->callback == &option_command )
+      return 0;
+    return complete_subopts( children, word, word, out, max );
+  } else if( positional ) {
+    return 0;
+  } else if( word[0] == '-' && word[1] == '-' ) {
+    eq = strchr( word + 2, '=' );
+    if( eq == NULL )
+      return complete_names( options, false, "--", 2, word + 2, strlen( word + 2 ), out, max );
+    option = complete_find( options, false, word + 2, eq - word - 2 );
+    if( option == NULL || (children = option_children( option )) == NULL ||
+        option->callback == &option_command )
+      return 0;
+    return complete_subopts( children, word, eq + 1, out, max );
+  } else if( word[0] == '-' ) {
+    /* abbreviations are complete already, but "-" may become anything */
+    if( word[1] != '\0' )
+      return 0;
+    return complete_names( options, false, "--", 2, "", 0, out, max );
+  }
+  return complete_names( options, true, "", 0, word, strlen( word ), out, max );
+}
+
+/** Format `n` completions into `buf`, one per line, as far as they fit. */
+static size_t complete_format( const choice_completion_t* out, int n, char* buf, size_t size ) {
+  size_t used = 0;
+  int i, len;
+
+  for( i = 0; i < n; i++ ) {
+    len = snprintf( buf + used, size - used, "%.*s%s\n",
+                    (int) out[i].len, out[i].lead, out[i].option->name );
+    if( len < 0 || (size_t) len >= size - used )
+      break;
+    used += len;
+  }
+  return used;
+}
+
+/** Write `n` completions to `fd`, one per line. */
+void choice_complete_write( int fd, const choice_completion_t* out, int n ) {
+  char buf[CHOICE_COMPLETE_BUFFER];
+  size_t size = complete_format( out, n, buf, sizeof(buf) );
+  size_t done = 0;
+  ssize_t got;
+
+  while( done < size && (got = write( fd, buf + done, size - done )) > 0 )
+    done += got;
+}
+
+/**
+ * Answer completion requests on the Unix socket `path`, one connection
+ * at a time, until accepting fails. A request is the words of the
+ * command line, each terminated by NUL (the last one may be cut off by
+ * the end of the request); the answer is one candidate per line.
+ * Clients end the request by shutting down their side for writing
+ * (`shutdown( fd, SHUT_WR )`); one that stays silent for
+ * `CHOICE_COMPLETE_TIMEOUT` is answered with what it sent so far.
+ * Only a socket already at `path` is replaced.
+ * With socat, a shell completion function is a one-liner:
+ *
+ *     printf '%s\0' "${COMP_WORDS[@]:0:COMP_CWORD+1}" | socat - UNIX-CONNECT:$path
+ */
+int choice_complete_serve( const option_table_t* table, const char* path ) {
+  static char buf[CHOICE_COMPLETE_BUFFER + 1];
+  static const char* words[CHOICE_COMPLETE_BUFFER + 1];
+  choice_completion_t out[CHOICE_COMPLETE_MAX];
+  struct timeval timeout = { CHOICE_COMPLETE_TIMEOUT / 1000, CHOICE_COMPLETE_TIMEOUT % 1000 * 1000 };
+  struct sockaddr_un addr;
+  struct stat st;
+  size_t size;
+  ssize_t got;
+  char* str;
+  int sock, conn, argc, n;
+
+  if( strlen( path ) >= sizeof(addr.sun_path) )
+    return -1;
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+
+  if( (sock = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 )
+    return -1;
+  if( lstat( path, &st ) == 0 && S_ISSOCK( st.st_mode ) )
+    unlink( path );
+  if( bind( sock, (struct sockaddr*) &addr, sizeof(addr) ) != 0 || listen( sock, 16 ) != 0 ) {
+    close( sock );
+    return -1;
+  }
+
+  while( (conn = accept( sock, NULL, NULL )) >= 0 ) {
+    setsockopt( conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+    for( size = 0; size < CHOICE_COMPLETE_BUFFER; size += got )
+      if( (got = read( conn, buf + size, CHOICE_COMPLETE_BUFFER - size )) <= 0 )
+        break;
+    buf[size] = '\0';
+
+    for( argc = 0, str = buf; str < buf + size; str += strlen( str ) + 1 )
+      words[argc++] = str;
+    n = choice_complete( table, argc, words, out, CHOICE_COMPLETE_MAX );
+    /* the client may be gone already, that is no reason to die */
+    size = complete_format( out, n, buf, CHOICE_COMPLETE_BUFFER );
+    send( conn, buf, size, MSG_NOSIGNAL );
+    close( conn );
+  }
+  close( sock );
+  return -1;
+}
+
+/** @} */
+
+#ifdef TESTS
+void distance_demo( int (*callback)( const char*, const char* ) ) {
+  int i;
+  struct {
+    const char* a;
+    const char* b;
+    int d;
+  } lev[] = {
+    { "test", "test", 0 },
     { "test", "tset", 0 },
     { "test", "test1", 0 },
     { "test", "tes", 0 },
@@ -659,6 +4927,1155 @@ void distance_demo( int (*callback)( const char*, const char* ) ) {
     printf( "  ( \"%s\", \"%s\" ) -> %i\n", lev[i].a, lev[i].b, lev[i].d );
   }
 }
+
+/**
+ * Fuzzy lookups through the lanes must pick the same option as comparing
+ * one by one with `choice_fuzzycmp` (and give up on the same first tie),
+ * for short names, names too long for the lanes, and tables that are too
+ * large to prune.
+ */
+int lanes_demo( void ) {
+  static char names[300][272];
+  static option_t options[301];
+  static const int sizes[] = { 1, 7, 33, 100, 300 };
+  option_table_t table;
+  option_t* expect;
+  option_t* option;
+  option_t* ambig;
+  char str[272];
+  int s, i, j, n, len, val, max, tie, checked = 0, failed = 0;
+
+  srand( 1 );
+  for( s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++ ) {
+    for( n = 0; n < sizes[s]; ) {
+      len = (rand() % 4 == 0) ? 250 + rand() % 20 : 1 + rand() % 10;
+      for( j = 0; j < len; j++ )
+        names[n][j] = "abcd"[rand() % 4];
+      names[n][len] = '\0';
+      for( i = 0; i < n && strcmp( names[i], names[n] ) != 0; i++ );
+      if( i == n ) {
+        options[n].name = names[n];
+        n++;
+      }
+    }
+    options[n].name = NULL;
+    if( option_table_init( &table, options ) )
+      return 1;
+
+    for( j = 0; j < 200; j++ ) {
+      strcpy( str, names[rand() % n] );
+      len = strlen( str );
+      for( i = rand() % 3; i >= 0; i-- )
+        str[rand() % len] = "abcd"[rand() % 4];
+      if( option_table_find( &table, str, len ) != NULL )
+        continue;
+
+      expect = NULL;
+      max = INT_MAX;
+      tie = 0;
+      for( i = 0; i < n && !tie; i++ ) {
+        if( (val = choice_fuzzycmp( names[i], str )) < 0 || val > max )
+          continue;
+        tie = (val == max);
+        if( !tie ) {
+          max = val;
+          expect = &(options[i]);
+        }
+      }
+      option = option_lookup( &table, 0, str, len, &ambig );
+      failed |= tie ? (option != NULL || ambig != expect) : (option != expect || ambig != NULL);
+      checked++;
+    }
+    option_table_free( &table );
+  }
+
+  printf( "  %i lookups, %s\n", checked, failed ? "failed" : "ok" );
+  return failed;
+}
+
+/** Names too far off to be taken still get a "did you mean". */
+int suggest_demo( void ) {
+  static const struct {
+    const char* str;
+    int n;
+    int first;
+  } names[] = {
+    { "colorize", 1, 0 }, { "no-color", 1, 0 }, { "verbosity", 1, 1 }, { "help", 0, 0 }
+  };
+  bool color = false, verbose = false, required = false;
+  const char* output = NULL;
+  option_t options[] = {
+    OPTION_TRUE( "color", "colorize", 'c', color ),
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', verbose ),
+    OPTION_STR( "output", "where to", 'o', output ),
+    OPTION_TRUE( "required", "needed", 'r', required ),
+    OPTION_EOL
+  };
+  option_t* suggestions[3];
+  option_t* ambig;
+  option_table_t table;
+  int i, n, failed = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  for( i = 0; i < sizeof(names) / sizeof(names[0]); i++ ) {
+    failed |= option_lookup( &table, 0, names[i].str, strlen( names[i].str ), &ambig ) != NULL;
+    n = option_table_suggest( &table, names[i].str, suggestions, 3 );
+    failed |= n != names[i].n || (n > 0 && suggestions[0] != &(options[names[i].first]));
+    printf( "  %s: %s\n", names[i].str, (n > 0) ? suggestions[0]->name : "-" );
+  }
+  option_table_free( &table );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/**
+ * Parse with an arena, and make sure nothing was allocated, not even
+ * for a typo in a name too long for the bounded distance.
+ */
+int arena_demo( void ) {
+  static char scratch[16384];
+  static char name[301], typo[304];
+  choice_arena_t arena = CHOICE_ARENA(scratch);
+  choice_arena_t tiny = { scratch, 64, 0 };
+  bool verbose = false, write = true, longest = false;
+  long bsize = 0;
+  option_t subopts[] = {
+    { "rw", "read-write mode", '\0', OPTION_NODASH, &option_true, &write },
+    { "ro", "read-only mode", '\0', OPTION_NODASH, &option_false, &write },
+    { "bs", "block size", '\0', OPTION_REQARG|OPTION_NODASH, &option_long, &bsize },
+    OPTION_EOL
+  };
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', verbose ),
+    OPTION_SUBOPT( "subopt", "extra options", 's', subopts ),
+    OPTION_TRUE( name, "a very long name", '\0', longest ),
+    OPTION_EOL
+  };
+  char args[3][16] = { "arena", "--vebrose", "-sro,bs=4096" };
+  char* argv[4] = { args[0], args[1], args[2], typo };
+  unsigned long before;
+  int error, small;
+
+  memset( name, 'x', sizeof(name) - 1 );
+  sprintf( typo, "--%.*sy", (int) sizeof(name) - 2, name );
+  before = allocations;
+  error = option_parse_arena( options, 4, argv, &arena );
+  small = option_parse_arena( options, 4, argv, &tiny );
+
+  printf( "  verbose: %s, write: %s, bsize: %li, longest: %s\n",
+          verbose ? "true" : "false", write ? "true" : "false", bsize, longest ? "true" : "false" );
+  printf( "  error: %i, too small: %i, allocations: %lu\n",
+          error, small, allocations - before );
+  return error != 0 || small != OPTION_ENOMEM || allocations != before ||
+         !verbose || write || bsize != 4096 || !longest || arena.used != 0;
+}
+
+/** Repeat an option many times, and make sure every value was kept. */
+int list_demo( void ) {
+  static char scratch[1 << 21];
+  choice_arena_t arena = CHOICE_ARENA(scratch);
+  choice_list_t includes = CHOICE_LIST(&arena), levels = CHOICE_LIST(NULL), verbose = CHOICE_LIST(&arena);
+  option_t options[] = {
+    OPTION_STRS( "include", "add a search path", 'I', includes ),
+    OPTION_LONGS( "level", "add a level", 'l', levels ),
+    OPTION_BOOLS( "verbose", "more verbose", 'v', verbose ),
+    OPTION_EOL
+  };
+  enum { N = 100000 };
+  static char args[N][16];
+  static char* argv[N + 1];
+  const char** paths;
+  long* numbers;
+  int i, error;
+
+  argv[0] = "list";
+  for( i = 1; i <= N; i++ ) {
+    argv[i] = args[i - 1];
+    if( i % 3 == 0 )
+      snprintf( args[i - 1], sizeof(args[0]), "-l%i", i );
+    else if( i % 3 == 1 )
+      snprintf( args[i - 1], sizeof(args[0]), "-I/usr/%i", i );
+    else
+      snprintf( args[i - 1], sizeof(args[0]), "-v" );
+  }
+  error = option_parse( options, N + 1, argv );
+  paths = includes.items;
+  numbers = levels.items;
+
+  printf( "  include: %zu, level: %zu, verbose: %zu, arena used: %zu\n",
+          includes.count, levels.count, verbose.count, arena.used );
+  error = error != 0 || includes.count != (N + 2) / 3 || levels.count != N / 3 ||
+          verbose.count != (N + 1) / 3 || strcmp( paths[0], "/usr/1" ) != 0 ||
+          paths[includes.count - 1] != argv[N - (N % 3 == 1 ? 0 : N % 3 == 2 ? 1 : 2)] + 2 ||
+          numbers[levels.count - 1] != N - N % 3;
+  choice_list_free( &levels );
+  return error;
+}
+
+/**
+ * Resolve names across subcommands: the subcommand's own options shadow
+ * those around it, by name as by abbreviation, and a positional argument
+ * that looks like a command is taken for what it is.
+ */
+int command_demo( void ) {
+  bool outer = false, inner = false, force = false, all = false;
+  option_t install[] = {
+    OPTION_TRUE( "verbose", "verbose install", 'v', inner ),
+    OPTION_TRUE( "force", "force install", 'f', force ),
+    OPTION_EOL
+  };
+  option_t info[] = {
+    OPTION_TRUE( "all", "all packages", 'a', all ),
+    OPTION_EOL
+  };
+  option_t options[] = {
+    OPTION_COMMAND( "install", "install packages", install ),
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', outer ),
+    OPTION_COMMAND( "info", "describe packages", info ),
+    OPTION_EOL
+  };
+  option_t broken[] = {
+    { "broken", "no options", '\0', OPTION_NODASH, &option_command, NULL },
+    OPTION_EOL
+  };
+  static const struct {
+    const char* word;
+    int command;
+  } words[] = {
+    { "a", -1 }, { "i", -1 }, { "inst", 0 }, { "inf", 2 }, { "instal", 0 }, { "infoo", -1 }
+  };
+  char args[4][16] = { "command", "install", "--verbose", "-v" };
+  char* argv[4] = { args[0], args[1], args[2], NULL };
+  int i, failed = 0;
+
+  failed |= option_parse( options, 3, argv ) != 0 || outer || !inner;
+  inner = false;
+  argv[2] = args[3];
+  failed |= option_parse( options, 3, argv ) != 0 || outer || !inner;
+
+  /* "instal" is a package, not the command once more */
+  inner = false;
+  strcpy( args[2], "instal" );
+  argv[2] = args[2];
+  argv[3] = args[3];
+  failed |= option_parse( options, 4, argv ) != 0 || inner;
+
+  /* commands go by exact name or unique prefix, never by a typo */
+  for( i = 0; i < sizeof(words) / sizeof(words[0]); i++ ) {
+    options[0].flags &= ~OPTION_CALLED;
+    options[2].flags &= ~OPTION_CALLED;
+    strcpy( args[1], words[i].word );
+    failed |= option_parse( options, 2, argv ) != 0 ||
+              ((options[0].flags & OPTION_CALLED) != 0) != (words[i].command == 0) ||
+              ((options[2].flags & OPTION_CALLED) != 0) != (words[i].command == 2);
+  }
+  failed |= option_parse( broken, 2, argv ) != OPTION_EINVAL;
+
+  printf( "  outer: %s, inner: %s\n", outer ? "true" : "false", inner ? "true" : "false" );
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/**
+ * Parse a vector of several chunks serially and in parallel, once as
+ * it is and once with an unknown option in it: the lists, positional
+ * arguments and errors have to be the same.
+ */
+int parallel_demo( void ) {
+  static const char* const pool[][2] = {
+    { "--include", "/usr" }, { "--inclde=/opt" }, { "--level", "3" }, { "--levl=4" },
+    { "-vl", "5" }, { "-v" }, { "--verbose" }, { "file" }, { "-I/srv" }
+  };
+  enum { N = 3 * CHOICE_PARALLEL_CHUNK + 100 };
+  static const char* argv[N];
+  static const char* positional[2][N];
+  choice_list_t includes[2], levels[2], verbose[2];
+  choice_parser_t parser[2];
+  option_table_t table;
+  int run, i, j, error[2], failed = 0;
+
+  srand( 2 );
+  argv[0] = "parallel";
+  for( i = 1; i < N - 1; ) {
+    j = rand() % (sizeof(pool) / sizeof(pool[0]));
+    argv[i++] = pool[j][0];
+    if( pool[j][1] != NULL )
+      argv[i++] = pool[j][1];
+  }
+  argv[N - 50] = "--";
+  argv[N - 1] = "file";
+
+  for( run = 0; run < 2; run++ ) {
+    if( run == 1 )
+      argv[2 * CHOICE_PARALLEL_CHUNK + 7] = "--bogus";
+    for( i = 0; i < 2; i++ ) {
+      option_t options[] = {
+        OPTION_STRS( "include", "add a search path", 'I', includes[i] ),
+        OPTION_LONGS( "level", "add a level", 'l', levels[i] ),
+        OPTION_BOOLS( "verbose", "more verbose", 'v', verbose[i] ),
+        OPTION_EOL
+      };
+      includes[i] = levels[i] = verbose[i] = (choice_list_t) CHOICE_LIST(NULL);
+      if( option_table_init( &table, options ) )
+        return 1;
+      choice_parser_init( &(parser[i]), &table );
+      parser[i].positional = positional[i];
+      error[i] = (i == 0) ? choice_parse( &(parser[i]), N, argv )
+                          : choice_parse_parallel( &(parser[i]), N, argv, 4 );
+      option_table_free( &table );
+    }
+
+    failed |= error[0] != error[1] || error[0] != ((run == 0) ? 0 : OPTION_EINVAL) ||
+              parser[0].index != parser[1].index || parser[0].error.index != parser[1].error.index ||
+              parser[0].positionals != parser[1].positionals ||
+              memcmp( positional[0], positional[1], parser[0].positionals * sizeof(char*) ) != 0 ||
+              includes[0].count != includes[1].count || levels[0].count != levels[1].count ||
+              verbose[0].count != verbose[1].count ||
+              memcmp( includes[0].items, includes[1].items, includes[0].count * sizeof(char*) ) != 0 ||
+              memcmp( levels[0].items, levels[1].items, levels[0].count * sizeof(long) ) != 0 ||
+              memcmp( verbose[0].items, verbose[1].items, verbose[0].count * sizeof(bool) ) != 0;
+    printf( "  error %i at %i, %zu includes, %zu levels, %i positionals\n", error[1],
+            parser[1].error.index, includes[1].count, levels[1].count, parser[1].positionals );
+    for( i = 0; i < 2; i++ ) {
+      choice_list_free( &(includes[i]) );
+      choice_list_free( &(levels[i]) );
+      choice_list_free( &(verbose[i]) );
+    }
+  }
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/**
+ * Parse many jobs on four threads, each into its own record: every
+ * record holds the values of its own job, a bad value fails only its
+ * job, and a table with an option storing into its own `data` is
+ * refused for all of them.
+ */
+int batch_demo( void ) {
+  typedef struct { long level; bool verbose; unsigned long long size; } record_t;
+  enum { N = 1000 };
+  static char numbers[N][16];
+  static const char* argv[N][5];
+  static record_t records[N];
+  static choice_job_t jobs[N];
+  long shared = 0;
+  option_t options[] = {
+    OPTION_LONG( "level", "how much", 'l', shared ),
+    OPTION_TRUE( "verbose", "more", 'v', shared ),
+    OPTION_SIZE( "size", "how large", 's', shared ),
+    OPTION_EOL
+  };
+  size_t offsets[] = {
+    offsetof( record_t, level ), offsetof( record_t, verbose ), offsetof( record_t, size )
+  };
+  choice_batch_t batch = { NULL, offsets, 4 };
+  option_table_t table;
+  size_t failed;
+  int i, bad = 0;
+
+  for( i = 0; i < N; i++ ) {
+    sprintf( numbers[i], "%i", i );
+    argv[i][0] = "batch";
+    argv[i][1] = "--level";
+    argv[i][2] = numbers[i];
+    argv[i][3] = (i % 2) ? "-v" : "--size=1k";
+    argv[i][4] = (i % 7) ? "--size=2k" : "--size=bad";
+    memset( &(records[i]), 0, sizeof(records[i]) );
+    jobs[i] = (choice_job_t) { 5, argv[i], &(records[i]) };
+  }
+  if( option_table_init( &table, options ) )
+    return 1;
+  batch.table = &table;
+  failed = choice_batch_parse( &batch, jobs, N );
+  bad |= failed != (N + 6) / 7 || batch.failed != failed || batch.jobs != N || shared != 0;
+  for( i = 0; i < N && !bad; i++ ) {
+    bad |= records[i].level != i || records[i].verbose != (i % 2);
+    if( i % 7 )
+      bad |= jobs[i].error != 0 || records[i].size != 2000;
+    else
+      bad |= jobs[i].error != OPTION_EVALUE || jobs[i].detail.index != 4 ||
+             jobs[i].detail.option != &(options[2]) || records[i].size != ((i % 2) ? 0 : 1000);
+  }
+  printf( "  %zu of %zu jobs failed, %llu arguments\n", failed, batch.jobs, batch.args );
+
+  /* --size stores into `shared` for every job */
+  offsets[2] = CHOICE_NO_OFFSET;
+  failed = choice_batch_parse( &batch, jobs, N );
+  for( i = 0; i < N && !bad; i++ )
+    bad |= jobs[i].error != OPTION_EINVAL || jobs[i].detail.option != &(options[2]);
+  bad |= failed != N || shared != 0;
+  option_table_free( &table );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/**
+ * Where `choice_parse` and `option_parse` part ways: a parameter that
+ * looks like an option, and one that is missing at the end. A list of
+ * suboptions that is optional may be left out with either.
+ */
+int parser_demo( void ) {
+  const char* name = NULL;
+  bool verbose = false, fast = false;
+  option_t subopts[] = { OPTION_TRUE( "fast", "go fast", '\0', fast ), OPTION_EOL };
+  option_t options[] = {
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_TRUE( "x", "anything", 'x', verbose ),
+    { "opts", "suboptions, if any", 'o', OPTION_OPTARG, &option_subopt, subopts },
+    OPTION_EOL
+  };
+  const char* const dash[] = { "parser", "--opts", "--name", "-x" };
+  const char* const end[] = { "parser", "-x", "-o", "--name" };
+  char args[4][16] = { "parser", "--opts", "--name", "-x" };
+  char* argv[4] = { args[0], args[1], args[2], args[3] };
+  choice_parser_t parser;
+  option_table_t table;
+  int bad = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_parser_init( &parser, &table );
+  bad |= choice_parse( &parser, 4, dash ) != OPTION_EREQARG || parser.error.index != 2 ||
+         parser.error.option != &(options[0]) || name != NULL;
+  bad |= choice_parse( &parser, 4, end ) != OPTION_EREQARG || parser.error.index != 3 || !verbose;
+  bad |= option_parse( options, 4, argv ) != 0 || name == NULL || strcmp( name, "-x" ) != 0;
+  name = NULL;
+  bad |= option_parse( options, 3, argv ) != 0 || name != NULL || fast;
+  printf( "  choice_parse: --name -x fails, option_parse: name %s\n", argv[3] );
+  option_table_free( &table );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/**
+ * Parse options mixed with positional arguments: these are set aside in
+ * order, a parameter that looks like one is still taken, everything
+ * after `--` is positional, and without room for them the parse stops
+ * at the first.
+ */
+int positional_demo( void ) {
+  static const char* const argv[] = {
+    "positional", "a", "-v", "b", "--name", "c", "d", "-", "-n", "e", "f", "--level=2",
+    "--", "-x", "--name", "g"
+  };
+  static const char* const expect[] = { "a", "b", "d", "-", "f", "-x", "--name", "g" };
+  enum { N = sizeof(argv) / sizeof(argv[0]), P = sizeof(expect) / sizeof(expect[0]) };
+  const char* bad_argv[] = { "positional", "a", "--nmae", "b", "c", "--bogus", "d" };
+  const char* positional[N];
+  const char* name = NULL;
+  bool verbose = false;
+  long level = 0;
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "more", 'v', verbose ),
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_EOL
+  };
+  choice_parser_t parser;
+  option_table_t table;
+  int i, error, bad = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_parser_init( &parser, &table );
+  parser.positional = positional;
+  error = choice_parse( &parser, N, argv );
+  bad |= error != 0 || !verbose || level != 2 || name == NULL || strcmp( name, "e" ) != 0 ||
+         parser.positionals != P || parser.index != N;
+  for( i = 0; i < P && !bad; i++ )
+    bad |= strcmp( positional[i], expect[i] ) != 0;
+  printf( "  %i positionals, name %s, index %i\n", parser.positionals, name, parser.index );
+
+  /* up to an error, the ones before it are there */
+  name = NULL;
+  error = choice_parse( &parser, 7, bad_argv );
+  bad |= error != OPTION_EINVAL || parser.error.index != 5 || parser.positionals != 2 ||
+         strcmp( name, "b" ) != 0 || strcmp( positional[1], "c" ) != 0;
+
+  /* without room, the first one ends the options */
+  verbose = false;
+  parser.positional = NULL;
+  error = choice_parse( &parser, N, argv );
+  bad |= error != 0 || verbose || parser.index != 1 || parser.positionals != 0;
+  option_table_free( &table );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/**
+ * Cut command strings into arguments like `sh` would: quotes of both
+ * kinds, escapes and lines joined by a backslash. An open quote and
+ * more words than there is room for fail.
+ */
+int shell_demo( void ) {
+  static const char* const expect[] = {
+    "prog", "-v", "single \"quoted\"", "double 'quoted' \"$x\" \\n", "--name=it's",
+    "--level", "3", "positional", ""
+  };
+  enum { N = sizeof(expect) / sizeof(expect[0]) };
+  char str[128];
+  const char* argv[N];
+  const char* positional[N];
+  const char* name = NULL;
+  bool verbose = false;
+  long level = 0;
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "more", 'v', verbose ),
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_EOL
+  };
+  choice_parser_t parser;
+  option_table_t table;
+  int i, error, bad = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_parser_init( &parser, &table );
+  parser.positional = positional;
+  strcpy( str, "prog  -v 'single \"quoted\"'\t\"double 'quoted' \\\"\\$x\\\" \\n\" "
+               "--name=it\\'s \\\n --level \\\n3 pos\\\nitional ''\n" );
+  error = choice_parse_shell( &parser, str, argv, N );
+  bad |= error != 0 || !verbose || level != 3 || name == NULL || strcmp( name, "it's" ) != 0 ||
+         parser.positionals != 4 || positional[0] != argv[2] || positional[3] != argv[8];
+  for( i = 0; i < N && !bad; i++ )
+    bad |= strcmp( argv[i], expect[i] ) != 0;
+  printf( "  %i positionals:", parser.positionals );
+  for( i = 0; i < parser.positionals; i++ )
+    printf( " [%s]", positional[i] );
+  printf( "\n" );
+
+  strcpy( str, "prog -v 'open --name" );
+  bad |= choice_parse_shell( &parser, str, argv, N ) != OPTION_EVALUE || parser.error.index != 2;
+  strcpy( str, "prog \"open" );
+  bad |= choice_parse_shell( &parser, str, argv, N ) != OPTION_EVALUE;
+  strcpy( str, "prog open\\" );
+  bad |= choice_parse_shell( &parser, str, argv, N ) != OPTION_EVALUE;
+  strcpy( str, "prog a b c" );
+  bad |= choice_parse_shell( &parser, str, argv, 3 ) != OPTION_ENOMEM || parser.error.index != 3;
+  strcpy( str, "prog a b" );
+  bad |= choice_parse_shell( &parser, str, argv, 3 ) != 0 || parser.positionals != 2;
+  option_table_free( &table );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/**
+ * Edit a line at random and compare its tokens with those of the same
+ * text split from scratch. Appending to a long line looks up only the
+ * tokens at the end, not the whole line again.
+ */
+int line_demo( void ) {
+  static const char* const snippets[] = {
+    " --level", " 3", " -vl", "4", " --verbose", " --", " file", "-", "e", " --lvel=2", " -v",
+    " --name", " -n"
+  };
+  bool verbose = false;
+  long level = 0;
+  const char* name = NULL;
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', verbose ),
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_EOL
+  };
+  option_table_t table;
+  choice_line_t line, fresh;
+  char text[4096];
+  size_t len = 0, pos, del, add;
+  const char* str;
+  int i, k, failed = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_line_init( &line, &table );
+  srand( 3 );
+  for( i = 0; i < 2000; i++ ) {
+    str = snippets[rand() % (sizeof(snippets) / sizeof(snippets[0]))];
+    add = strlen( str );
+    pos = rand() % (len + 1);
+    del = (rand() % 3 == 0) ? rand() % (len - pos + 1) % 12 : 0;
+    if( len - del + add >= sizeof(text) ) {
+      pos = 0;
+      del = len;
+    }
+    memmove( text + pos + add, text + pos + del, len - pos - del );
+    memcpy( text + pos, str, add );
+    len = len - del + add;
+    failed |= choice_line_edit( &line, pos, del, str, add ) != 0;
+
+    choice_line_init( &fresh, &table );
+    failed |= choice_line_set( &fresh, text, len ) != 0 || fresh.count != line.count ||
+              line.len != len || memcmp( line.text, text, len ) != 0;
+    for( k = 0; k < fresh.count && k < line.count; k++ )
+      failed |= line.tokens[k].pos != fresh.tokens[k].pos || line.tokens[k].len != fresh.tokens[k].len ||
+                line.tokens[k].kind != fresh.tokens[k].kind ||
+                line.tokens[k].option != fresh.tokens[k].option ||
+                line.tokens[k].error != fresh.tokens[k].error;
+    choice_line_free( &fresh );
+  }
+
+  /* a parameter follows its option, even if only the option was edited */
+  choice_line_set( &line, "--level 3 x", 11 );
+  choice_line_edit( &line, 2, 5, "name", 4 );
+  failed |= line.count != 3 || line.tokens[1].option != &(options[2]);
+
+  /* the rest of the line stays as it was */
+  choice_line_set( &line, "-v", 2 );
+  for( i = 0; i < 200; i++ )
+    choice_line_edit( &line, line.len, 0, " --lvel=2", 9 );
+  choice_line_edit( &line, line.len, 0, " -v", 3 );
+  failed |= line.count != 202 || line.lookups > 2;
+  printf( "  %u tokens, %u lookups for the last edit\n", line.count, line.lookups );
+  choice_line_free( &line );
+  option_table_free( &table );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/** Send `len` bytes to the completion server at `path`, and read the answer. */
+static size_t complete_ask( const char* path, const char* req, size_t len, bool end,
+                            char* answer, size_t size ) {
+  struct sockaddr_un addr;
+  size_t used = 0;
+  ssize_t got;
+  int fd, tries;
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path );
+  if( (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) < 0 )
+    return 0;
+  /* the server may not be listening yet */
+  for( tries = 0; connect( fd, (struct sockaddr*) &addr, sizeof(addr) ) != 0 && tries < 100; tries++ )
+    usleep( 10000 );
+  for( ; used < len && (got = write( fd, req + used, len - used )) > 0; used += got );
+  if( end )
+    shutdown( fd, SHUT_WR );
+  for( used = 0; used < size - 1 && (got = read( fd, answer + used, size - 1 - used )) > 0; used += got );
+  answer[used] = '\0';
+  close( fd );
+  return used;
+}
+
+/**
+ * Complete prefixes, typos, subcommands and suboptions, then ask a
+ * completion server, with a request too long for it and a client that
+ * never finishes its request in between.
+ */
+int complete_demo( void ) {
+  static char request[CHOICE_COMPLETE_BUFFER + 100];
+  bool verbose = false, write = true, force = false;
+  const char* output = NULL;
+  long bsize = 0;
+  option_t subopts[] = {
+    { "rw", "read-write mode", '\0', OPTION_NODASH, &option_true, &write },
+    { "ro", "read-only mode", '\0', OPTION_NODASH, &option_false, &write },
+    { "bs", "block size", '\0', OPTION_REQARG|OPTION_NODASH, &option_long, &bsize },
+    OPTION_EOL
+  };
+  option_t install[] = {
+    OPTION_TRUE( "force", "overwrite", 'f', force ),
+    OPTION_EOL
+  };
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', verbose ),
+    OPTION_STR( "output", "where to", 'o', output ),
+    OPTION_SUBOPT( "mount", "mount options", 'm', subopts ),
+    OPTION_COMMAND( "install", "install a package", install ),
+    OPTION_EOL
+  };
+  const char* const prefix[] = { "prog", "--ver" };
+  const char* const typo[] = { "prog", "--outptu" };
+  const char* const command[] = { "prog", "inst" };
+  const char* const nested[] = { "prog", "install", "--f" };
+  const char* const subopt[] = { "prog", "--mount", "rw,b" };
+  choice_completion_t out[CHOICE_COMPLETE_MAX];
+  option_table_t table;
+  char dir[] = "/tmp/choice-complete-XXXXXX";
+  char path[64], file[64], answer[256];
+  pid_t pid;
+  int fd, n, failed = 0;
+
+  if( option_table_init( &table, options ) )
+    return 1;
+  n = choice_complete( &table, 2, prefix, out, CHOICE_COMPLETE_MAX );
+  failed |= n != 1 || out[0].option != &(options[0]) || out[0].fuzzy || out[0].len != 2;
+  n = choice_complete( &table, 2, typo, out, CHOICE_COMPLETE_MAX );
+  failed |= n < 1 || out[0].option != &(options[1]) || !out[0].fuzzy;
+  n = choice_complete( &table, 2, command, out, CHOICE_COMPLETE_MAX );
+  failed |= n != 1 || out[0].option != &(options[3]);
+  n = choice_complete( &table, 3, nested, out, CHOICE_COMPLETE_MAX );
+  failed |= n != 1 || out[0].option != &(install[0]);
+  n = choice_complete( &table, 3, subopt, out, CHOICE_COMPLETE_MAX );
+  failed |= n < 1 || out[0].option != &(subopts[2]) || out[0].len != 3;
+
+  if( mkdtemp( dir ) == NULL )
+    return 1;
+  snprintf( path, sizeof(path), "%s/sock", dir );
+  snprintf( file, sizeof(file), "%s/file", dir );
+
+  /* a file in the way is not removed */
+  if( (fd = open( file, O_WRONLY|O_CREAT, 0600 )) >= 0 )
+    close( fd );
+  failed |= choice_complete_serve( &table, file ) != -1 || access( file, F_OK ) != 0;
+
+  if( (pid = fork()) == 0 )
+    _exit( choice_complete_serve( &table, path ) );
+  /* only NUL bytes: as many words as the request is long */
+  complete_ask( path, request, sizeof(request), true, answer, sizeof(answer) );
+  /* this one is answered once it timed out */
+  complete_ask( path, "prog\0--o", 8, false, answer, sizeof(answer) );
+  failed |= strncmp( answer, "--output\n", 9 ) != 0;
+  complete_ask( path, "prog\0--ver", 10, true, answer, sizeof(answer) );
+  failed |= strncmp( answer, "--verbose\n", 10 ) != 0;
+  kill( pid, SIGTERM );
+  waitpid( pid, NULL, 0 );
+  unlink( path );
+  unlink( file );
+  rmdir( dir );
+  option_table_free( &table );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/** Write `text` to the file `path`, for the demos that read files. */
+static void demo_write( const char* path, const char* text ) {
+  int fd;
+
+  if( (fd = open( path, O_WRONLY|O_CREAT|O_TRUNC, 0600 )) >= 0 ) {
+    if( write( fd, text, strlen( text ) ) < 0 )
+      perror( path );
+    close( fd );
+  }
+}
+
+/**
+ * Expand nested, quoted and escaped `@file`s, one that includes itself
+ * until the depth limit, and unmap them again.
+ */
+int response_demo( void ) {
+  static const char* const expect[] = { "a b", "c \"d\"", "e f", "inner", "@lit", "@x" };
+  choice_list_t items = CHOICE_LIST(NULL);
+  option_t options[] = {
+    OPTION_STRS( "item", "add an item", 'i', items ),
+    OPTION_EOL
+  };
+  char dir[] = "/tmp/choice-response-XXXXXX";
+  char outer[64], inner[64], self[64], text[160], arg[72], lit[] = "@@x", flag[] = "-i";
+  char* argv[4] = { "response", arg, flag, lit };
+  option_table_t table;
+  const char** strs;
+  long page = sysconf( _SC_PAGESIZE );
+  void* mapped;
+  int i, error, failed = 0;
+
+  if( mkdtemp( dir ) == NULL )
+    return 1;
+  sprintf( outer, "%s/outer", dir );
+  sprintf( inner, "%s/inner", dir );
+  sprintf( self, "%s/self", dir );
+  sprintf( text, "-i 'a b' -i \"c \\\"d\\\"\" -i e\\ f @%s -i @@lit\n", inner );
+  demo_write( outer, text );
+  demo_write( inner, "--item=inner" );
+  sprintf( text, "-i x @%s", self );
+  demo_write( self, text );
+
+  /* nested and quoted, kept by the table until it is released */
+  sprintf( arg, "@%s", outer );
+  if( option_table_init( &table, options ) )
+    return 1;
+  error = option_table_parse( &table, 4, argv );
+  strs = items.items;
+  failed |= error != 0 || items.count != sizeof(expect) / sizeof(expect[0]) || table.mappings == NULL;
+  for( i = 0; !failed && i < items.count; i++ )
+    failed |= strcmp( strs[i], expect[i] ) != 0;
+  mapped = (void*) ((unsigned long) strs[0] & ~(page - 1));
+  failed |= msync( mapped, page, MS_ASYNC ) != 0;
+  option_table_release( &table );
+  failed |= table.mappings != NULL || msync( mapped, page, MS_ASYNC ) == 0;
+  option_table_free( &table );
+  choice_list_free( &items );
+
+  /* the innermost "@self" is one too deep, and taken as it is */
+  sprintf( arg, "@%s", self );
+  error = option_parse( options, 2, argv );
+  failed |= error != 0 || items.count != CHOICE_RESPONSE_DEPTH || parsed == NULL;
+  printf( "  %zu items from a file including itself\n", items.count );
+  option_parse_release();
+  failed |= parsed != NULL;
+  choice_list_free( &items );
+
+  unlink( outer );
+  unlink( inner );
+  unlink( self );
+  rmdir( dir );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/**
+ * Look up typos through a cache of 8 entries and without one: the
+ * answers (an option, an ambiguity, nothing) must be the same, the
+ * second lookup of a typo a hit, and a cleared cache empty.
+ */
+int cache_demo( void ) {
+  static const char* const typos[] = { "verbos", "carx", "nothing-like-it", "verbos", "carx", "nothing-like-it" };
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "more", 'v', options ), OPTION_TRUE( "version", "show it", 'V', options ),
+    OPTION_TRUE( "cart", "a cart", 'c', options ), OPTION_TRUE( "card", "a card", 'd', options ),
+    OPTION_EOL
+  };
+  option_table_t cached, plain;
+  choice_cache_t* cache = choice_cache_new( 8 );
+  option_t* ambig[2];
+  option_t* option[2];
+  unsigned long long hits, misses;
+  char typo[16];
+  int i, bad = 0;
+
+  if( cache == NULL || option_table_init( &cached, options ) || option_table_init( &plain, options ) )
+    return 1;
+  option_table_cache( &cached, cache );
+  for( i = 0; i < 26 + 6; i++ ) {
+    if( i < 6 )
+      strcpy( typo, typos[i] );
+    else
+      sprintf( typo, "verbos%c", 'A' + i - 6 );
+    option[0] = option_lookup( &cached, 0, typo, strlen( typo ), &(ambig[0]) );
+    option[1] = option_lookup( &plain, 0, typo, strlen( typo ), &(ambig[1]) );
+    bad |= option[0] != option[1] || ambig[0] != ambig[1];
+    /* an ambiguity is remembered as one */
+    bad |= i == 4 && (option[0] != NULL || ambig[0] == NULL);
+  }
+  bad |= option_lookup( &cached, 0, "verbose", 7, &(ambig[0]) ) != &(options[0]);
+  choice_cache_stats( cache, &hits, &misses );
+  printf( "  %llu hits, %llu misses\n", hits, misses );
+  bad |= hits != 3 || misses != 3 + 26;
+
+  /* "verbosZ" is still there, until cleared */
+  option_lookup( &cached, 0, "verbosZ", 7, &(ambig[0]) );
+  choice_cache_clear( cache );
+  option_lookup( &cached, 0, "verbosZ", 7, &(ambig[0]) );
+  choice_cache_stats( cache, &hits, &misses );
+  bad |= hits != 4 || misses != 3 + 26 + 1;
+
+  option_table_free( &cached );
+  option_table_free( &plain );
+  choice_cache_free( cache );
+  /* more entries than there are sets of ways fails, but returns */
+  choice_cache_free( choice_cache_new( UINT_MAX ) );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/* a positional callback that copies its parameters, comma separated */
+static int demo_collect( option_t* option, const char* arg ) {
+  char* list = option->data;
+  size_t len = strlen( list );
+  if( len + strlen( arg ) + 2 > 64 )
+    return OPTION_ENOMEM;
+  sprintf( list + len, "%s%s", (len > 0) ? "," : "", arg );
+  return 0;
+}
+
+/**
+ * Feed one stream in chunks of every size from 1 byte up, with an
+ * argument longer than `CHOICE_STREAM_MAX` and options waiting for
+ * their parameter across chunks: each must come out the same.
+ */
+int stream_demo( void ) {
+  static const char text[] = "-v\0--level\0" "42\0first\0-l\0" "9\0--size=2k\0second\0"
+                             "--level=x\0-s\0" "3\0@\0-l";
+  char list[64] = "";
+  bool verbose = false;
+  unsigned long long size = 0;
+  const char* name = NULL;
+  long level = 0;
+  option_t options[] = {
+    OPTION_TRUE( "verbose", "more", 'v', verbose ),
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_SIZE( "size", "how large", 's', size ),
+    OPTION_EOL
+  }, positional = { "file", "a file", 0, OPTION_REQARG, &demo_collect, list };
+  option_t keeping[] = { OPTION_STR( "name", "who", 'n', name ), OPTION_EOL };
+  choice_stream_t stream;
+  option_table_t table;
+  size_t chunk, at, n, big = CHOICE_STREAM_MAX + 16;
+  char* huge = malloc( big );
+  int bad = 0, error;
+
+  if( huge == NULL || option_table_init( &table, keeping ) )
+    return 1;
+  error = choice_stream_init( &stream, &table );
+  bad |= error != OPTION_EINVAL || stream.parser.error.option != &(keeping[0]);
+  choice_stream_free( &stream );
+  option_table_free( &table );
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_stream_init( &stream, &table );
+  stream.positional = &(keeping[0]);
+  bad |= choice_stream_push( &stream, "a", 2 ) != OPTION_EINVAL || stream.args != 0;
+  choice_stream_free( &stream );
+
+  memset( huge, 'x', big );
+  for( chunk = 1; chunk <= sizeof(text) && !bad; chunk++ ) {
+    verbose = false, level = size = 0, list[0] = '\0';
+    choice_stream_init( &stream, &table );
+    stream.positional = &positional;
+    choice_stream_push( &stream, text, 11 );
+    for( at = 0; at < big; at += n )
+      choice_stream_push( &stream, huge + at, n = (big - at < 4096) ? big - at : 4096 );
+    choice_stream_push( &stream, "\0", 1 );
+    for( at = 11; at < sizeof(text) - 1; at += n )
+      choice_stream_push( &stream, text + at, n = (sizeof(text) - 1 - at < chunk) ? sizeof(text) - 1 - at : chunk );
+    error = choice_stream_end( &stream );
+    /* 12 arguments, the huge one, and "-l" at the end; ENOMEM, EVALUE and EREQARG */
+    bad |= !verbose || level != 9 || size != 3 || strcmp( list, "first,second,@" ) != 0 ||
+           stream.args != 14 || stream.errors != 3 || error != OPTION_EREQARG;
+    if( bad || chunk == sizeof(text) )
+      printf( "  %zu byte chunks: level %li, size %llu, files %s, %llu of %llu failed\n", chunk,
+              level, size, list, stream.errors, stream.args );
+    choice_stream_free( &stream );
+  }
+  option_table_free( &table );
+  free( huge );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/* callbacks that take their time, and notice if they overlap */
+static int demo_inside = 0, demo_overlaps = 0;
+
+static int demo_slow( option_t* option, bool value ) {
+  if( __atomic_add_fetch( &demo_inside, 1, __ATOMIC_SEQ_CST ) > 1 )
+    __atomic_add_fetch( &demo_overlaps, 1, __ATOMIC_SEQ_CST );
+  usleep( 50 );
+  *(bool*) option->data = value;
+  __atomic_sub_fetch( &demo_inside, 1, __ATOMIC_SEQ_CST );
+  return 0;
+}
+
+static int demo_slow_true( option_t* option, const char* arg ) {
+  return demo_slow( option, true );
+}
+
+static int demo_slow_false( option_t* option, const char* arg ) {
+  return demo_slow( option, false );
+}
+
+/**
+ * Run deferred callbacks on several threads: `--color` and `--no-color`
+ * store to one `bool` and must not overlap, two bad values both fail,
+ * an option after a failed one is not run, and two options waiting for
+ * each other fail.
+ */
+int defer_demo( void ) {
+  bool color = false, alpha = false, beta = false;
+  unsigned long long size = 0;
+  const char* name = NULL;
+  long level = 0;
+  option_t options[] = {
+    { "color", "colorize", 'c', 0, &demo_slow_true, &color },
+    { "no-color", "do not colorize", 'C', 0, &demo_slow_false, &color },
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_TRUE( "alpha", "first", 'a', alpha ),
+    OPTION_TRUE( "beta", "second", 'b', beta ),
+    OPTION_SIZE( "size", "how large", 's', size ),
+    OPTION_EOL
+  };
+  const choice_after_t after[] = {
+    { &(options[3]), &(options[2]) }, { &(options[4]), &(options[5]) }, { &(options[5]), &(options[4]) }
+  };
+  static const int errors[] = {
+    OPTION_EVALUE, OPTION_EDEPEND, OPTION_EDEPEND, OPTION_EDEPEND, OPTION_EVALUE
+  };
+  enum { N = 100 };
+  const char* argv[N + 9];
+  choice_defer_t defer = CHOICE_DEFER(after, 3, 4);
+  choice_parser_t parser;
+  option_table_t table;
+  size_t failed;
+  int i, error, bad = 0;
+
+  argv[0] = "defer";
+  for( i = 1; i <= N; i++ )
+    argv[i] = (i % 2) ? "--color" : "--no-color";
+  argv[N + 1] = "--level=x";
+  argv[N + 2] = "--name=n";
+  argv[N + 3] = "--alpha";
+  argv[N + 4] = "--beta";
+  argv[N + 5] = "--size=zz";
+  if( option_table_init( &table, options ) )
+    return 1;
+  choice_parser_init( &parser, &table );
+  parser.defer = &defer;
+  error = choice_parse( &parser, N + 6, argv );
+  failed = choice_defer_run( &parser, &defer );
+
+  bad |= error != 0 || defer.count != N + 5 || failed != 5 || color || demo_overlaps != 0 ||
+         name != NULL || alpha || beta || parser.error.code != OPTION_EVALUE;
+  for( i = 0; !bad && i < 5; i++ )
+    bad |= defer.events[N + i].error != errors[i];
+  for( i = 0; !bad && i < N; i++ )
+    bad |= defer.events[i].error != 0;
+  printf( "  %zu of %zu failed, color: %s, overlaps: %i\n",
+          failed, defer.count, color ? "true" : "false", demo_overlaps );
+  choice_defer_free( &defer );
+  option_table_free( &table );
+
+  printf( "  %s\n", bad ? "failed" : "ok" );
+  return bad;
+}
+
+/**
+ * Reload a config file after a bad value: the options that were not
+ * applied (the bad one and those after it) are applied once it is fixed.
+ */
+int config_demo( void ) {
+  static const char* const files[] = {
+    "level = 3\nname = a\n", "level = x\nname = b\n", "level = 4\nname = b\n"
+  };
+  static const int errors[] = { 0, OPTION_EVALUE, 0 };
+  char path[] = "/tmp/choice-config-XXXXXX";
+  const char* name = NULL;
+  long level = 0;
+  option_t options[] = {
+    OPTION_LONG( "level", "how much", 'l', level ),
+    OPTION_STR( "name", "who", 'n', name ),
+    OPTION_EOL
+  };
+  option_table_t table;
+  choice_config_t config;
+  int fd, i, error, failed = 0;
+
+  if( (fd = mkstemp( path )) < 0 )
+    return 1;
+  close( fd );
+  option_table_init( &table, options );
+  choice_config_init( &config, &table );
+  for( i = 0; i < sizeof(files) / sizeof(files[0]); i++ ) {
+    if( (fd = open( path, O_WRONLY|O_TRUNC )) < 0 || write( fd, files[i], strlen( files[i] ) ) < 0 )
+      failed = 1;
+    close( fd );
+    error = (i == 0) ? choice_config_file( &config, path ) : choice_config_reload( &config );
+    failed |= error != errors[i];
+    printf( "  reload %i: error %i, level %li, name %s, changed %u\n",
+            i, error, level, name, config.changed );
+  }
+  failed |= level != 4 || name == NULL || strcmp( name, "b" ) != 0 || config.changed != 2;
+  choice_config_free( &config );
+  option_table_free( &table );
+  unlink( path );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
+/** Decode some well- and some malformed values. */
+int decode_demo( void ) {
+  static const struct {
+    const char* str;
+    int error;
+    long value;
+  } longs[] = {
+    { "4096", 0, 4096 }, { "-12", 0, -12 }, { "0x1F", 0, 31 }, { "0o755", 0, 493 },
+    { "123456789012345678", 0, 123456789012345678 }, { "9223372036854775807", 0, LONG_MAX },
+    { "-9223372036854775808", 0, LONG_MIN }, { "9223372036854775808", OPTION_ERANGE, 0 },
+    { "99999999999999999999999", OPTION_ERANGE, 0 }, { "12ab", OPTION_EVALUE, 0 },
+    { "", OPTION_EVALUE, 0 }, { "0755", 0, 755 }, { "08", 0, 8 }, { "-010", 0, -10 },
+    { "0o8", OPTION_EVALUE, 0 }
+  };
+  static const struct {
+    const char* str;
+    int error;
+    unsigned long long value;
+  } sizes[] = {
+    { "4096", 0, 4096 }, { "4K", 0, 4000 }, { "4Ki", 0, 4096 }, { "2Mi", 0, 2097152 },
+    { "1G", 0, 1000000000 }, { "16Ei", OPTION_EVALUE, 0 }, { "20000000Ti", OPTION_ERANGE, 0 }
+  }, durations[] = {
+    { "10", 0, 10000000000ull }, { "1.5h", 0, 5400000000000ull }, { "250ms", 0, 250000000 },
+    { "0.000000001s", 0, 1 }, { "3d", 0, 259200000000000ull }, { "5 s", OPTION_EVALUE, 0 },
+    { "010s", 0, 10000000000ull }
+  };
+  choice_list_t cpus = CHOICE_LIST(NULL);
+  choice_range_t* range;
+  unsigned long long size = 1;
+  bool verbose = false;
+  option_t options[] = {
+    { "size", "optional size", 's', OPTION_OPTARG, &option_size, &size },
+    OPTION_TRUE( "verbose", "enable verbose stuff", 'v', verbose ),
+    OPTION_EOL
+  };
+  char args[3][16] = { "decode", "-s", "-v" };
+  char* argv[3] = { args[0], args[1], args[2] };
+  const char* const long_argv[] = { "decode", "--size", "--verbose" };
+  option_table_t table;
+  choice_parser_t parser;
+  long value;
+  double ratio;
+  int i, error, failed = 0;
+
+  /* a missing parameter is malformed, or 0 for an optional one */
+  failed |= choice_decode_long( NULL, &value ) != OPTION_EVALUE;
+  failed |= choice_decode_size( NULL, &size ) != OPTION_EVALUE;
+  failed |= choice_decode_duration( NULL, &size ) != OPTION_EVALUE;
+  failed |= choice_decode_double( NULL, &ratio ) != OPTION_EVALUE;
+  failed |= choice_decode_ranges( NULL, &cpus ) != OPTION_EVALUE;
+  failed |= option_parse( options, 3, argv ) != 0 || size != 0 || !verbose;
+  size = 1;
+  verbose = false;
+  option_table_init( &table, options );
+  choice_parser_init( &parser, &table );
+  failed |= choice_parse( &parser, 3, long_argv ) != 0 || size != 0 || !verbose;
+  option_table_free( &table );
+
+  for( i = 0; i < sizeof(longs) / sizeof(longs[0]); i++ ) {
+    value = 0;
+    error = choice_decode_long( longs[i].str, &value );
+    failed |= error != longs[i].error || (error == 0 && value != longs[i].value);
+  }
+  for( i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+    error = choice_decode_size( sizes[i].str, &size );
+    failed |= error != sizes[i].error || (error == 0 && size != sizes[i].value);
+  }
+  for( i = 0; i < sizeof(durations) / sizeof(durations[0]); i++ ) {
+    error = choice_decode_duration( durations[i].str, &size );
+    failed |= error != durations[i].error || (error == 0 && size != durations[i].value);
+  }
+  failed |= choice_decode_double( "0.25", &ratio ) != 0 || ratio != 0.25;
+  failed |= choice_decode_double( "1e999", &ratio ) != OPTION_ERANGE;
+  failed |= choice_decode_double( "0.25x", &ratio ) != OPTION_EVALUE;
+
+  failed |= choice_decode_ranges( "2048,0-1023,1024-1500", &cpus ) != 0;
+  failed |= choice_decode_ranges( "4-2", &cpus ) != OPTION_EVALUE;
+  failed |= choice_decode_ranges( "4000-4100,1600", &cpus ) != 0;
+  range = cpus.items;
+  for( i = 0; i < cpus.count; i++ )
+    printf( "  %lu-%lu", range[i].first, range[i].last );
+  printf( "\n" );
+  failed |= cpus.count != 4 || range[0].last != 1500 || !choice_ranges_has( &cpus, 4050 ) ||
+            choice_ranges_has( &cpus, 1501 ) || !choice_ranges_has( &cpus, 2048 );
+  choice_list_free( &cpus );
+
+  printf( "  %s\n", failed ? "failed" : "ok" );
+  return failed;
+}
+
 int main(void) {
   printf( "\nexact:\n" );
   distance_demo( &choice_exactcmp );
@@ -666,5 +6083,58 @@ int main(void) {
   distance_demo( &choice_prefixcmp );
   printf( "\nfuzzy:\n" );
   distance_demo( &choice_fuzzycmp );
+  printf( "\nlanes:\n" );
+  if( lanes_demo() )
+    return 1;
+  printf( "\nsuggest:\n" );
+  if( suggest_demo() )
+    return 1;
+  printf( "\narena:\n" );
+  if( arena_demo() )
+    return 1;
+  printf( "\nlist:\n" );
+  if( list_demo() )
+    return 1;
+  printf( "\ncommand:\n" );
+  if( command_demo() )
+    return 1;
+  printf( "\nparallel:\n" );
+  if( parallel_demo() )
+    return 1;
+  printf( "\ncache:\n" );
+  if( cache_demo() )
+    return 1;
+  printf( "\nbatch:\n" );
+  if( batch_demo() )
+    return 1;
+  printf( "\nparser:\n" );
+  if( parser_demo() )
+    return 1;
+  printf( "\npositional:\n" );
+  if( positional_demo() )
+    return 1;
+  printf( "\nshell:\n" );
+  if( shell_demo() )
+    return 1;
+  printf( "\nline:\n" );
+  if( line_demo() )
+    return 1;
+  printf( "\ncomplete:\n" );
+  if( complete_demo() )
+    return 1;
+  printf( "\nresponse:\n" );
+  if( response_demo() )
+    return 1;
+  printf( "\nstream:\n" );
+  if( stream_demo() )
+    return 1;
+  printf( "\ndefer:\n" );
+  if( defer_demo() )
+    return 1;
+  printf( "\nconfig:\n" );
+  if( config_demo() )
+    return 1;
+  printf( "\ndecode:\n" );
+  return decode_demo();
 }
 #endif
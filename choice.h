@@ -36,12 +36,18 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdbool.h>
 
 #define OPTION_EINVAL 1  /* invalid option */
 #define OPTION_ENOARG 2  /* option has no argument */
 #define OPTION_EREQARG 3 /* option requires an argument */
 #define OPTION_EONCE 4   /* option already seen */
 #define OPTION_EAMBIG 5  /* option is ambiguous */
+#define OPTION_ENOMEM 6  /* out of memory */
+#define OPTION_EVALUE 7  /* malformed parameter */
+#define OPTION_ERANGE 8  /* parameter out of range */
+#define OPTION_EFILE 9   /* file can not be read */
+#define OPTION_EDEPEND 10 /* option it depends on failed */
 
 typedef enum {
   OPTION_REQARG = 1,
@@ -49,10 +55,14 @@ typedef enum {
   OPTION_ARG = 3,
   OPTION_NODASH = 4,
   OPTION_MULTIPLE = 8,
-  OPTION_CALLED = 16
+  OPTION_CALLED = 16,
+  OPTION_ORDERED = 32
 } option_flag_t;
 
 typedef struct option_s option_t;
+typedef struct option_table_s option_table_t;
+typedef struct choice_cache_s choice_cache_t;
+typedef struct choice_mapping_s choice_mapping_t;
 
 typedef int (*option_cb)( option_t* option, const char* arg );
 
@@ -65,6 +75,353 @@ struct option_s {
   void* data;
 };
 
+/**
+ * Scratch memory supplied by the caller.
+ * Parsing with an arena takes everything it needs from `base` and
+ * never calls `malloc`.
+ */
+typedef struct choice_arena_s {
+  char* base;
+  size_t size;
+  size_t used;
+} choice_arena_t;
+
+#define CHOICE_ARENA(buf) \
+  { (char*) (buf), sizeof(buf), 0 }
+
+/** Number of option names the fuzzy matcher compares at once. */
+#define CHOICE_LANES 32
+
+/**
+ * A compiled option table.
+ * Built once from an `option_t[]` with `option_table_init`, it resolves
+ * exact names through a hash and abbreviations through a direct table,
+ * so only misspelled names pay for a fuzzy lookup. For that, the names
+ * are transposed into groups of `CHOICE_LANES` columns, so that one
+ * group can be scored in parallel, and indexed by length and character
+ * signature, so that only names that can still match are scored at all.
+ * Tables generated by `choice-gen` are static data instead, and hash
+ * names through `perfect`: one seed per bucket of `seeds` buckets
+ * (`perfect` is set even without names, `seeds` is then 0).
+ * Long-running programs can attach a `cache` of fuzzy resolutions.
+ * The tables of subcommands are compiled into `children` as they are
+ * first used. The `@file`s a parse expanded stay mapped in `mappings`
+ * until `option_table_release` (or `option_table_free`).
+ */
+struct option_table_s {
+  option_t* options;
+  unsigned count;
+  unsigned mask;
+  unsigned* slots;
+  unsigned* lengths;
+  unsigned groups;
+  unsigned* columns;
+  unsigned char* lanes;
+  unsigned long long* sigs;
+  unsigned* bylen;
+  unsigned* buckets;
+  unsigned longest;
+  choice_arena_t* arena;
+  unsigned* perfect;
+  unsigned seeds;
+  choice_cache_t* cache;
+  option_table_t** children;
+  choice_mapping_t* mappings;
+  unsigned abbr[256];
+};
+
+/**
+ * What went wrong in `choice_parse`: the error code, the option (if it
+ * was found), the offending name or parameter as pointer and length
+ * into the arguments, and the index of the argument.
+ */
+typedef struct choice_error_s {
+  int code;
+  option_t* option;
+  const char* arg;
+  size_t len;
+  int index;
+} choice_error_t;
+
+/**
+ * A callback put off by a parser with `defer` set: the option, its
+ * parameter and the index of the argument, and once it has run, what
+ * it returned. The rest is bookkeeping of `choice_defer_run`.
+ */
+typedef struct choice_event_s {
+  option_t* option;
+  const char* arg;
+  int index;
+  int error;
+  unsigned pending;
+  bool blocked;
+} choice_event_t;
+
+/** The callbacks of `option` run after those of `after`. */
+typedef struct choice_after_s {
+  const option_t* option;
+  const option_t* after;
+} choice_after_t;
+
+/**
+ * Callbacks recorded by a parse: `count` events, in the order of the
+ * arguments, for `choice_defer_run` to call on `threads` threads.
+ * Events of one option run one at a time, in order, and so do events
+ * of options storing to the same place, and all events of
+ * `OPTION_ORDERED` options. `after` declares `afters` more
+ * dependencies; an event whose dependency failed is not run, and fails
+ * with `OPTION_EDEPEND`. `failed` counts the events that failed.
+ */
+typedef struct choice_defer_s {
+  choice_event_t* events;
+  size_t count;
+  size_t capacity;
+  const choice_after_t* after;
+  size_t afters;
+  unsigned threads;
+  size_t failed;
+  char* copies;
+} choice_defer_t;
+
+#define CHOICE_DEFER(after, afters, threads) \
+  { NULL, 0, 0, (after), (afters), (threads), 0, NULL }
+
+/** Marks an option that keeps storing into its own `data`. */
+#define CHOICE_NO_OFFSET ((size_t) -1)
+
+/**
+ * State of one `choice_parse`. Any number of parsers may share a table.
+ * `arena`, if set, is used for the tables of uncompiled suboptions.
+ * `offsets`, if set, holds one offset per option of the table: instead
+ * of `data`, the option stores at that offset into `record`.
+ * `sources`, if set, holds one byte per option of the table: the
+ * `CHOICE_SOURCE_*` its value came from. Options set from a higher
+ * source than `source` are skipped, the others are marked (a list
+ * taken over from a lower source starts over).
+ * `defer`, if set, records the callbacks instead of calling them.
+ * `positional`, if set, has room for `argc` pointers: the parse then
+ * goes on past arguments that are not options, collecting them there
+ * in order (along with everything after `--`), and counts them in
+ * `positionals`.
+ * After the parse, `index` is the first argument that was not parsed.
+ */
+typedef struct choice_parser_s {
+  const option_table_t* table;
+  choice_arena_t* arena;
+  const size_t* offsets;
+  void* record;
+  unsigned char* sources;
+  unsigned char source;
+  choice_defer_t* defer;
+  const char** positional;
+  int positionals;
+  int index;
+  choice_error_t error;
+} choice_parser_t;
+
+#define CHOICE_TOKEN_OPTION 0 /* an option, or a group of abbreviations */
+#define CHOICE_TOKEN_PARAM 1  /* the parameter of the option before */
+#define CHOICE_TOKEN_ARG 2    /* a positional argument */
+#define CHOICE_TOKEN_END 3    /* `--` */
+
+/**
+ * A token of a `choice_line_t`: `len` characters at `pos` of the line,
+ * what kind of token it is, the option it names (or is the parameter
+ * of) and what is wrong with it, if anything. The rest is what the
+ * line remembers of it, to save looking it up again.
+ */
+typedef struct choice_token_s {
+  size_t pos;
+  size_t len;
+  int kind;
+  option_t* option;
+  int error;
+  option_t* resolved;
+  option_t* owner;
+  int lookup;
+  bool takes;
+  unsigned char state;
+} choice_token_t;
+
+/**
+ * A command line being edited, see `choice_line_edit`: the `text`,
+ * and `count` tokens. `lookups` counts the names looked up for the
+ * last edit.
+ */
+typedef struct choice_line_s {
+  const option_table_t* table;
+  char* text;
+  size_t len;
+  size_t size;
+  choice_token_t* tokens;
+  unsigned count;
+  unsigned capacity;
+  unsigned lookups;
+  unsigned char state;
+  option_t* owner;
+} choice_line_t;
+
+/**
+ * A parse of a stream of NUL terminated arguments, see
+ * `choice_stream_push`. `positional` (if set) is called back with the
+ * arguments that are not options. `args` and `errors` count the
+ * arguments and the ones that failed; the rest is the state of the
+ * parse: the start of an argument that is carried over to the next
+ * chunk, and the option waiting for its parameter.
+ */
+typedef struct choice_stream_s {
+  choice_parser_t parser;
+  option_t* positional;
+  unsigned long long args;
+  unsigned long long errors;
+  bool ended;
+  char* buffer;
+  size_t len;
+  bool overflow;
+  bool rest;
+  option_t* pending;
+} choice_stream_t;
+
+#define CHOICE_SOURCE_DEFAULT 0
+#define CHOICE_SOURCE_FILE 1
+#define CHOICE_SOURCE_ENV 2
+#define CHOICE_SOURCE_ARGV 3
+
+/**
+ * Options gathered from a config file, an environment variable and
+ * the arguments, in increasing order of precedence, see
+ * `choice_config_init`. `parser` describes the last error; for the
+ * file, its `index` is the line. The file stays mapped at `text` until
+ * it is reloaded, the values given to callbacks live until their key
+ * changes. `changed` counts the keys called back by the last load.
+ */
+typedef struct choice_config_s {
+  choice_parser_t parser;
+  const char* path;
+  const char* text;
+  size_t size;
+  char* env;
+  unsigned char* sources;
+  struct choice_value_s* values;
+  unsigned changed;
+} choice_config_t;
+
+/**
+ * One argument vector of a batch, and where its results go:
+ * values into `record`, the outcome of the parse into the rest.
+ */
+typedef struct choice_job_s {
+  int argc;
+  const char* const* argv;
+  void* record;
+  int error;
+  int index;
+  choice_error_t detail;
+} choice_job_t;
+
+/**
+ * Many jobs parsed against one table, see `choice_batch_parse`.
+ * Set `table`, `offsets` (as in `choice_parser_t`) and `threads`;
+ * the rest are counters filled in when the batch is done.
+ */
+typedef struct choice_batch_s {
+  const option_table_t* table;
+  const size_t* offsets;
+  unsigned threads;
+  size_t jobs;
+  size_t failed;
+  unsigned long long args;
+  unsigned long long nanoseconds;
+} choice_batch_t;
+
+/**
+ * A candidate for the word being completed: `len` characters of `lead`
+ * (the dashes, or the suboptions before the one being completed),
+ * followed by the name of `option`. `score` is the prefix or fuzzy
+ * distance, as returned by the comparator.
+ */
+typedef struct choice_completion_s {
+  option_t* option;
+  const char* lead;
+  size_t len;
+  bool fuzzy;
+  int score;
+} choice_completion_t;
+
+/**
+ * Everything an `OPTION_MULTIPLE` option was given: `count` values at
+ * `items`, in order, collected by `option_strs`, `option_longs` or
+ * `option_bools`. The array grows geometrically, in `arena` if set
+ * (keep that apart from the arena a parse scratches in), else on the
+ * heap, see `choice_list_free`. Strings point into the arguments.
+ */
+typedef struct choice_list_s {
+  void* items;
+  size_t count;
+  size_t capacity;
+  choice_arena_t* arena;
+} choice_list_t;
+
+#define CHOICE_LIST(arena) \
+  { NULL, 0, 0, (arena) }
+
+/**
+ * What the library has been up to, counted when compiled with
+ * `CHOICE_STATS`: parses (suboption lists included), names resolved
+ * exactly, by abbreviation or fuzzily, ambiguous names, distance
+ * computations (one at a time, or a group of lanes at once) and the
+ * cells they evaluated, heap allocations, and the callbacks along with
+ * the time spent in them (nested suboptions count twice).
+ */
+typedef struct choice_stats_s {
+  unsigned long long parses;
+  unsigned long long exact;
+  unsigned long long abbr;
+  unsigned long long fuzzy;
+  unsigned long long ambiguous;
+  unsigned long long levenshtein;
+  unsigned long long lanes;
+  unsigned long long cells;
+  unsigned long long allocations;
+  unsigned long long callbacks;
+  unsigned long long callback_ns;
+} choice_stats_t;
+
+#define CHOICE_TRACE_BEGIN 0
+#define CHOICE_TRACE_END 1
+
+/**
+ * Trace hook: `event` begins or ends the argument `arg`, the `index`th
+ * of the parse (counting the contents of `@file`s, where there are
+ * any). `error` is the outcome of an argument that ended.
+ */
+typedef void (*choice_trace_cb)( void* context, int event, const char* arg, int index, int error );
+
+/** An interval of `option_ranges`, both ends included. */
+typedef struct choice_range_s {
+  unsigned long first;
+  unsigned long last;
+} choice_range_t;
+
+/** One `key[=value]` of a suboption list, as pointer and length. */
+typedef struct choice_item_s {
+  const char* key;
+  size_t klen;
+  const char* value;
+  size_t vlen;
+} choice_item_t;
+
+/**
+ * One word of a command string, as pointer and length: quotes and
+ * backslashes included, `quoted` if there are any (then
+ * `choice_shell_unquote` has to take them out).
+ */
+typedef struct choice_word_s {
+  const char* str;
+  size_t len;
+  bool quoted;
+} choice_word_t;
+
 extern int option_true( option_t* option, const char* arg );
 extern int option_false( option_t* option, const char* arg );
 extern int option_long( option_t* option, const char* arg );
@@ -72,6 +429,16 @@ extern int option_str( option_t* option, const char* arg );
 extern int option_log( option_t* option, const char* arg );
 extern int option_help( option_t* option, const char* arg );
 extern int option_subopt( option_t* option, const char* arg );
+extern int option_subtable( option_t* option, const char* arg );
+extern int option_command( option_t* option, const char* arg );
+extern int option_strs( option_t* option, const char* arg );
+extern int option_longs( option_t* option, const char* arg );
+extern int option_bools( option_t* option, const char* arg );
+extern void choice_list_free( choice_list_t* list );
+extern int option_size( option_t* option, const char* arg );
+extern int option_duration( option_t* option, const char* arg );
+extern int option_double( option_t* option, const char* arg );
+extern int option_ranges( option_t* option, const char* arg );
 
 #define OPTION_TRUE(name, desc, abbr, bool_var) \
   { name, desc, abbr, 0, option_true, &bool_var }
@@ -83,11 +450,98 @@ extern int option_subopt( option_t* option, const char* arg );
   { name, desc, abbr, OPTION_REQARG, option_str, &str_var }
 #define OPTION_SUBOPT(name, desc, abbr, opts) \
   { name, desc, abbr, OPTION_REQARG, option_subopt, &(opts[0]) }
+#define OPTION_SUBTABLE(name, desc, abbr, table) \
+  { name, desc, abbr, OPTION_REQARG, option_subtable, &table }
+#define OPTION_COMMAND(name, desc, opts) \
+  { name, desc, '\0', OPTION_NODASH, option_command, &(opts[0]) }
+#define OPTION_STRS(name, desc, abbr, list) \
+  { name, desc, abbr, OPTION_REQARG|OPTION_MULTIPLE, option_strs, &list }
+#define OPTION_LONGS(name, desc, abbr, list) \
+  { name, desc, abbr, OPTION_REQARG|OPTION_MULTIPLE, option_longs, &list }
+#define OPTION_BOOLS(name, desc, abbr, list) \
+  { name, desc, abbr, OPTION_MULTIPLE, option_bools, &list }
+#define OPTION_SIZE(name, desc, abbr, size_var) \
+  { name, desc, abbr, OPTION_REQARG, option_size, &size_var }
+#define OPTION_DURATION(name, desc, abbr, ns_var) \
+  { name, desc, abbr, OPTION_REQARG, option_duration, &ns_var }
+#define OPTION_DOUBLE(name, desc, abbr, double_var) \
+  { name, desc, abbr, OPTION_REQARG, option_double, &double_var }
+#define OPTION_RANGES(name, desc, abbr, list) \
+  { name, desc, abbr, OPTION_REQARG|OPTION_MULTIPLE, option_ranges, &list }
 #define OPTION_EOL \
   { NULL, NULL, '\0', 0, NULL, NULL }
 
 extern int option_parse( option_t* options, int argc, char* argv[] );
 extern int subopt_parse( option_t* options, char *argv );
+extern int choice_decode_long( const char* str, long* value );
+extern int choice_decode_size( const char* str, unsigned long long* value );
+extern int choice_decode_duration( const char* str, unsigned long long* nanoseconds );
+extern int choice_decode_double( const char* str, double* value );
+extern int choice_decode_ranges( const char* str, choice_list_t* ranges );
+extern bool choice_ranges_has( const choice_list_t* ranges, unsigned long value );
+extern size_t choice_subopt_split( const char* str, size_t len, choice_item_t* items, size_t max,
+                                   size_t* used );
+extern size_t choice_shell_split( const char* str, size_t len, choice_word_t* words, size_t max,
+                                  size_t* used );
+extern size_t choice_shell_unquote( const choice_word_t* word, char* out );
+
+extern void* choice_arena_alloc( choice_arena_t* arena, size_t size );
+extern int option_parse_arena( option_t* options, int argc, char* argv[], choice_arena_t* arena );
+extern void option_parse_release( void );
+extern int subopt_parse_arena( option_t* options, char* argv, choice_arena_t* arena );
+
+extern unsigned choice_hash( const char* str, size_t len, unsigned seed );
+extern int option_table_init( option_table_t* table, option_t* options );
+extern int option_table_init_arena( option_table_t* table, option_t* options, choice_arena_t* arena );
+extern size_t option_table_size( option_t* options );
+extern void option_table_free( option_table_t* table );
+extern void option_table_release( option_table_t* table );
+extern int option_table_parse( option_table_t* table, int argc, char* argv[] );
+extern int subopt_table_parse( option_table_t* table, char* argv );
+extern choice_cache_t* choice_cache_new( unsigned entries );
+extern void choice_cache_free( choice_cache_t* cache );
+extern void choice_cache_clear( choice_cache_t* cache );
+extern void choice_cache_stats( choice_cache_t* cache, unsigned long long* hits, unsigned long long* misses );
+extern void option_table_cache( option_table_t* table, choice_cache_t* cache );
+extern int option_table_suggest( const option_table_t* table, const char* str,
+                                 option_t* out[], int k );
+
+extern void choice_parser_init( choice_parser_t* parser, const option_table_t* table );
+extern int choice_parse( choice_parser_t* parser, int argc, const char* const argv[] );
+extern int choice_parse_subopt( choice_parser_t* parser, const option_table_t* table,
+                                const char* str, size_t len );
+extern int choice_parse_shell( choice_parser_t* parser, char* str, const char* argv[], int max );
+extern void choice_perror( const choice_error_t* error );
+extern size_t choice_batch_parse( choice_batch_t* batch, choice_job_t* jobs, size_t count );
+extern int choice_parse_parallel( choice_parser_t* parser, int argc, const char* const argv[],
+                                  unsigned threads );
+extern size_t choice_defer_run( choice_parser_t* parser, choice_defer_t* defer );
+extern void choice_defer_free( choice_defer_t* defer );
+
+extern int choice_stream_init( choice_stream_t* stream, const option_table_t* table );
+extern int choice_stream_push( choice_stream_t* stream, const char* data, size_t len );
+extern int choice_stream_end( choice_stream_t* stream );
+extern int choice_stream_fd( choice_stream_t* stream, int fd );
+extern void choice_stream_free( choice_stream_t* stream );
+
+extern void choice_line_init( choice_line_t* line, const option_table_t* table );
+extern int choice_line_edit( choice_line_t* line, size_t pos, size_t del, const char* str, size_t len );
+extern int choice_line_set( choice_line_t* line, const char* str, size_t len );
+extern void choice_line_free( choice_line_t* line );
+
+extern int choice_config_init( choice_config_t* config, const option_table_t* table );
+extern int choice_config_file( choice_config_t* config, const char* path );
+extern int choice_config_env( choice_config_t* config, const char* name );
+extern int choice_config_argv( choice_config_t* config, int argc, const char* const argv[] );
+extern int choice_config_reload( choice_config_t* config );
+extern void choice_config_free( choice_config_t* config );
+
+extern bool choice_stats( choice_stats_t* out, bool reset );
+extern bool choice_trace( choice_trace_cb hook, void* context );
+extern int choice_complete( const option_table_t* table, int argc, const char* const argv[],
+                            choice_completion_t* out, int max );
+extern void choice_complete_write( int fd, const choice_completion_t* out, int n );
+extern int choice_complete_serve( const option_table_t* table, const char* path );
 
 #ifdef __cplusplus
 }
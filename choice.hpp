@@ -0,0 +1,543 @@
+/* -*- Mode: C++; tab-width: 2; c-basic-offset: 2 -*- */
+/* vim:set softtabstop=2 shiftwidth=2: */
+/*
+ * choice -- the dyslexic option parser
+ * ====================================
+ *
+ * Copyright (c) 2013, Jonas Pommerening <jonas.pommerening@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR
+ * CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES;  LOSS OF USE, DATA, OR PROFITS;  OR BUSINESS
+ * INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  WHETHER IN
+ * CONTRACT,  STRICT LIABILITY,  OR TORT  (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __CHOICE_HPP
+#define __CHOICE_HPP
+
+/**
+ * Typed C++17 bindings: option tables are `constexpr`, bind to members
+ * of a config struct through member pointers (so a `long` option can
+ * not store into an `int`), and have their exact names hashed at
+ * compile time. A `bound` table stores the built-in types directly and
+ * only hands names that are not exact to the C parser, for the fuzzy
+ * route. Its `options()` work with `option_parse` and friends, too.
+ */
+
+#include "choice.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace choice {
+
+/** What an option does with its parameter. */
+enum class action : unsigned char {
+  set_true,
+  set_false,
+  store_long,
+  store_str,
+  store_view,
+  store_double,
+  store_size,
+  store_duration,
+  call
+};
+
+/**
+ * One option for the members of `Config`: like `option_t`, with the
+ * member it stores into in place of `data`. Names have to be string
+ * literals (or otherwise terminated), so the C side can use them.
+ */
+template<class Config>
+struct option {
+  typedef int (*callback_t)( Config& config, const char* arg );
+
+  /** The member an option stores into, as told by its `action`. */
+  union member_u {
+    bool Config::* b;
+    long Config::* l;
+    const char* Config::* s;
+    std::string_view Config::* v;
+    double Config::* d;
+    unsigned long long Config::* u;
+    callback_t f;
+
+    constexpr member_u( bool Config::* m ) : b( m ) {}
+    constexpr member_u( long Config::* m ) : l( m ) {}
+    constexpr member_u( const char* Config::* m ) : s( m ) {}
+    constexpr member_u( std::string_view Config::* m ) : v( m ) {}
+    constexpr member_u( double Config::* m ) : d( m ) {}
+    constexpr member_u( unsigned long long Config::* m ) : u( m ) {}
+    constexpr member_u( callback_t m ) : f( m ) {}
+  };
+
+  std::string_view name;
+  std::string_view desc;
+  char abbr;
+  unsigned flags;
+  action what;
+  member_u to;
+
+  /** The same option, with a parameter that may be left out. */
+  constexpr option optional() const {
+    option copy = *this;
+    copy.flags = (copy.flags & ~OPTION_ARG) | OPTION_OPTARG;
+    return copy;
+  }
+};
+
+/** Set a `bool` member to `true`, like `OPTION_TRUE`. */
+template<class Config>
+constexpr option<Config> flag( std::string_view name, std::string_view desc, char abbr,
+                               bool Config::* member ) {
+  return { name, desc, abbr, 0, action::set_true, member };
+}
+
+/** Set a `bool` member to `false`, like `OPTION_FALSE`. */
+template<class Config>
+constexpr option<Config> unflag( std::string_view name, std::string_view desc, char abbr,
+                                 bool Config::* member ) {
+  return { name, desc, abbr, 0, action::set_false, member };
+}
+
+/** Store a checked `long`, like `OPTION_LONG`. */
+template<class Config>
+constexpr option<Config> value( std::string_view name, std::string_view desc, char abbr,
+                                long Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_long, member };
+}
+
+/** Store the parameter as is, like `OPTION_STR`. */
+template<class Config>
+constexpr option<Config> value( std::string_view name, std::string_view desc, char abbr,
+                                const char* Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_str, member };
+}
+
+/** Store a view of the parameter. */
+template<class Config>
+constexpr option<Config> value( std::string_view name, std::string_view desc, char abbr,
+                                std::string_view Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_view, member };
+}
+
+/** Store a checked `double`, like `OPTION_DOUBLE`. */
+template<class Config>
+constexpr option<Config> value( std::string_view name, std::string_view desc, char abbr,
+                                double Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_double, member };
+}
+
+/** Store a byte count, like `OPTION_SIZE`. */
+template<class Config>
+constexpr option<Config> size( std::string_view name, std::string_view desc, char abbr,
+                               unsigned long long Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_size, member };
+}
+
+/** Store a duration in nanoseconds, like `OPTION_DURATION`. */
+template<class Config>
+constexpr option<Config> duration( std::string_view name, std::string_view desc, char abbr,
+                                   unsigned long long Config::* member ) {
+  return { name, desc, abbr, OPTION_REQARG, action::store_duration, member };
+}
+
+/** Call `callback` with the config and the parameter (if `flags` allow one). */
+template<class Config>
+constexpr option<Config> call( std::string_view name, std::string_view desc, char abbr,
+                               unsigned flags, int (*callback)( Config& config, const char* arg ) ) {
+  return { name, desc, abbr, flags, action::call, callback };
+}
+
+namespace detail {
+
+/** FNV-1a, the same at compile time and at run time. */
+constexpr unsigned hash( std::string_view str ) {
+  unsigned h = 2166136261u;
+  for( char c : str )
+    h = (h ^ (unsigned char) c) * 16777619u;
+  return h;
+}
+
+/** Slots of the name hash for `n` options: a power of two, at most half full. */
+constexpr std::size_t slots( std::size_t n ) {
+  std::size_t s = 1;
+  while( s < 2 * n )
+    s <<= 1;
+  return s;
+}
+
+/**
+ * Reject a table, because of `why`. Not `constexpr`: a table built at
+ * compile time that gets here does not compile. At run time, this
+ * throws `std::invalid_argument` (or aborts, without exceptions).
+ */
+[[noreturn]] inline void invalid_table( const char* why ) {
+#ifdef __cpp_exceptions
+  throw std::invalid_argument( why );
+#else
+  (void) why;
+  std::abort();
+#endif
+}
+
+} // namespace detail
+
+/**
+ * A table of `N` options for `Config`, made by `make_table`. Exact
+ * names resolve through `names` (the index of the option plus one, by
+ * hash, probed linearly) and abbreviations through `abbrs`, both built
+ * at compile time.
+ */
+template<class Config, std::size_t N>
+struct table {
+  static_assert( N > 0 && N < 65535, "a table has between 1 and 65534 options" );
+
+  std::array<option<Config>, N> options;
+  std::array<unsigned short, detail::slots( N )> names;
+  std::array<unsigned short, 256> abbrs;
+
+  /** The option called `name`, or `nullptr`. */
+  constexpr const option<Config>* find( std::string_view name ) const {
+    std::size_t slot = detail::hash( name ) & (names.size() - 1);
+
+    for( ; names[slot] != 0; slot = (slot + 1) & (names.size() - 1) ) {
+      if( options[names[slot] - 1].name == name )
+        return &(options[names[slot] - 1]);
+    }
+    return nullptr;
+  }
+
+  /** The option abbreviated `abbr`, or `nullptr`. */
+  constexpr const option<Config>* find( char abbr ) const {
+    unsigned short index = abbrs[(unsigned char) abbr];
+    return (index != 0) ? &(options[index - 1]) : nullptr;
+  }
+};
+
+/**
+ * Make a table of the options given. Declared `constexpr`, the table
+ * is static data, and duplicate names or abbreviations fail the build;
+ * a table made at run time throws `std::invalid_argument` for them.
+ */
+template<class Config, class... Options>
+constexpr table<Config, 1 + sizeof...(Options)> make_table( const option<Config>& first,
+                                                            const Options&... rest ) {
+  table<Config, 1 + sizeof...(Options)> result{ { { first, rest... } }, {}, {} };
+  std::size_t mask = result.names.size() - 1, slot = 0, i = 0;
+
+  for( i = 0; i < result.options.size(); i++ ) {
+    const option<Config>& option = result.options[i];
+
+    for( slot = detail::hash( option.name ) & mask; result.names[slot] != 0; slot = (slot + 1) & mask ) {
+      if( result.options[result.names[slot] - 1].name == option.name )
+        detail::invalid_table( "option name used twice" );
+    }
+    result.names[slot] = (unsigned short) (i + 1);
+
+    if( option.abbr != '\0' ) {
+      if( result.abbrs[(unsigned char) option.abbr] != 0 )
+        detail::invalid_table( "option abbreviation used twice" );
+      result.abbrs[(unsigned char) option.abbr] = (unsigned short) (i + 1);
+    }
+  }
+  return result;
+}
+
+/**
+ * A table bound to one `config`. `parse` works like `choice_parse`
+ * (see `parser()` for the index, the error and positional arguments),
+ * but stores the built-in types without a callback, and leaves only
+ * names that are not exact to the C parser. `options()` are the same
+ * options as an `option_t[]`, for `option_parse` and the C API; the
+ * table has to outlive them.
+ */
+template<class Config, std::size_t N>
+class bound {
+public:
+  bound( const table<Config, N>& table, Config& config )
+    : table_( table ), config_( config ), compiled_( false ),
+      options_( c_options( std::make_index_sequence<N>() ) ), c_table_(), parser_() {
+    choice_parser_init( &parser_, &c_table_ );
+  }
+
+  ~bound() {
+    if( compiled_ )
+      option_table_free( &c_table_ );
+  }
+
+  bound( const bound& ) = delete;
+  bound& operator=( const bound& ) = delete;
+
+  /** The options as an `option_t[]`, terminated by `OPTION_EOL`. */
+  option_t* options() {
+    return options_.data();
+  }
+
+  /** The compiled table of `options()`, or `nullptr` if out of memory. */
+  option_table_t* compiled() {
+    if( !compiled_ && option_table_init( &c_table_, options_.data() ) == 0 )
+      compiled_ = true;
+    return compiled_ ? &c_table_ : nullptr;
+  }
+
+  /** The C parser behind `parse`: index, error, positional arguments. */
+  choice_parser_t& parser() {
+    return parser_;
+  }
+
+  /** Parse `argv` (skipping the program name), see `choice_parse`. */
+  int parse( int argc, const char* const argv[] ) {
+    const option<Config>* option;
+    const char* arg;
+    const char* value;
+    int i, error = 0;
+
+    /* only the C parser knows how to defer, or to rank sources */
+    if( parser_.defer != nullptr || parser_.sources != nullptr || parser_.offsets != nullptr )
+      return fallback( argc, argv, 1 );
+
+    parser_.positionals = 0;
+    for( i = 1; i < argc && error == 0; i++ ) {
+      parser_.index = i;
+      arg = argv[i];
+      if( arg[0] != '-' || arg[1] == '\0' ) {
+        if( parser_.positional == nullptr )
+          break;
+        parser_.positional[parser_.positionals++] = arg;
+        continue;
+      } else if( arg[1] == '-' && arg[2] == '\0' ) {
+        /* "--" */
+        for( i++; parser_.positional != nullptr && i < argc; i++ )
+          parser_.positional[parser_.positionals++] = argv[i];
+        break;
+      }
+
+      if( arg[1] == '-' ) {
+        arg += 2;
+        if( (value = std::strchr( arg, '=' )) == nullptr )
+          value = arg + std::strlen( arg );
+        if( (option = table_.find( std::string_view( arg, value - arg ) )) == nullptr )
+          return fallback( argc, argv, i );
+        if( *value == '=' )
+          value++;
+
+        if( *value != '\0' ) {
+          error = invoke( *option, value, i );
+        } else if( (option->flags & OPTION_ARG) && i + 1 < argc && takes( *option, argv[i+1] ) ) {
+          i++;
+          error = invoke( *option, argv[i], i );
+        } else {
+          error = invoke( *option, nullptr, i );
+        }
+      } else {
+        for( arg++; *arg != '\0' && error == 0; arg++ ) {
+          if( (option = table_.find( *arg )) == nullptr )
+            return fail( OPTION_EINVAL, nullptr, arg, 1, i );
+
+          if( !(option->flags & OPTION_ARG) ) {
+            error = invoke( *option, nullptr, i );
+          } else if( arg[1] != '\0' ) {
+            error = invoke( *option, arg + 1, i );
+            break;
+          } else if( i + 1 < argc && takes( *option, argv[i+1] ) ) {
+            i++;
+            error = invoke( *option, argv[i], i );
+            break;
+          } else {
+            error = invoke( *option, nullptr, i );
+          }
+        }
+      }
+    }
+
+    parser_.index = i;
+    return error;
+  }
+
+private:
+  const table<Config, N>& table_;
+  Config& config_;
+  bool compiled_;
+  std::array<option_t, N + 1> options_;
+  option_table_t c_table_;
+  choice_parser_t parser_;
+
+  template<std::size_t... I>
+  std::array<option_t, N + 1> c_options( std::index_sequence<I...> ) {
+    return { { c_option( table_.options[I] )..., OPTION_EOL } };
+  }
+
+  /** The `option_t` of `option`: a built-in callback if there is one. */
+  option_t c_option( const option<Config>& option ) {
+    option_cb callback = &thunk;
+    void* data = this;
+
+    switch( option.what ) {
+      case action::set_true:
+        callback = &option_true;
+        data = &(config_.*(option.to.b));
+        break;
+      case action::set_false:
+        callback = &option_false;
+        data = &(config_.*(option.to.b));
+        break;
+      case action::store_long:
+        callback = &option_long;
+        data = &(config_.*(option.to.l));
+        break;
+      case action::store_str:
+        callback = &option_str;
+        data = &(config_.*(option.to.s));
+        break;
+      case action::store_double:
+        callback = &option_double;
+        data = &(config_.*(option.to.d));
+        break;
+      case action::store_size:
+        callback = &option_size;
+        data = &(config_.*(option.to.u));
+        break;
+      case action::store_duration:
+        callback = &option_duration;
+        data = &(config_.*(option.to.u));
+        break;
+      case action::store_view:
+      case action::call:
+        break;
+    }
+    return { option.name.data(), option.desc.data(), option.abbr, option.flags, callback, data };
+  }
+
+  /** Callback of the options that C has no built-in for. */
+  static int thunk( option_t* option, const char* arg ) {
+    bound* self = static_cast<bound*>( option->data );
+    return self->store( self->table_.options[option - self->options_.data()], arg );
+  }
+
+  /** Whether `option` takes `next` as its parameter, see `choice_parse`. */
+  static bool takes( const option<Config>& option, const char* next ) {
+    return next[0] != '-' || ((option.flags & OPTION_REQARG) && next[1] == '\0');
+  }
+
+  /** Store `arg` into the member of `option`. */
+  int store( const option<Config>& option, const char* arg ) {
+    long number = 0;
+    int error = 0;
+
+    switch( option.what ) {
+      case action::set_true:
+        config_.*(option.to.b) = true;
+        break;
+      case action::set_false:
+        config_.*(option.to.b) = false;
+        break;
+      case action::store_long:
+        if( arg == nullptr || (error = choice_decode_long( arg, &number )) == 0 )
+          config_.*(option.to.l) = number;
+        break;
+      case action::store_str:
+        config_.*(option.to.s) = arg;
+        break;
+      case action::store_view:
+        config_.*(option.to.v) = (arg != nullptr) ? std::string_view( arg ) : std::string_view();
+        break;
+      case action::store_double:
+        if( arg == nullptr )
+          config_.*(option.to.d) = 0;
+        else
+          error = choice_decode_double( arg, &(config_.*(option.to.d)) );
+        break;
+      case action::store_size:
+        if( arg == nullptr )
+          config_.*(option.to.u) = 0;
+        else
+          error = choice_decode_size( arg, &(config_.*(option.to.u)) );
+        break;
+      case action::store_duration:
+        if( arg == nullptr )
+          config_.*(option.to.u) = 0;
+        else
+          error = choice_decode_duration( arg, &(config_.*(option.to.u)) );
+        break;
+      case action::call:
+        error = option.to.f( config_, arg );
+        break;
+    }
+    return error;
+  }
+
+  /** Check the parameter of `option`, then store it, see `choice_invoke`. */
+  int invoke( const option<Config>& option, const char* arg, int index ) {
+    int error;
+
+    if( arg != nullptr && *arg == '\0' )
+      arg = nullptr;
+
+    if( arg == nullptr && (option.flags & OPTION_REQARG) )
+      return fail( OPTION_EREQARG, &option, nullptr, 0, index );
+    else if( arg != nullptr && !(option.flags & OPTION_ARG) )
+      return fail( OPTION_ENOARG, &option, arg, std::strlen( arg ), index );
+    if( (error = store( option, arg )) )
+      return fail( error, &option, arg, (arg != nullptr) ? std::strlen( arg ) : 0, index );
+    return 0;
+  }
+
+  /** Record an error in `parser()` and return its code. */
+  int fail( int code, const option<Config>* option, const char* arg, std::size_t len, int index ) {
+    parser_.error.code = code;
+    parser_.error.option = (option != nullptr) ? &(options_[option - table_.options.data()]) : nullptr;
+    parser_.error.arg = arg;
+    parser_.error.len = len;
+    parser_.error.index = index;
+    return code;
+  }
+
+  /**
+   * Parse the rest of `argv`, from `argv[i]` on, with the C parser (which
+   * knows what to make of names that are not exact).
+   */
+  int fallback( int argc, const char* const argv[], int i ) {
+    const char** positional = parser_.positional;
+    int positionals = (i > 1) ? parser_.positionals : 0;
+    int error;
+
+    if( compiled() == nullptr )
+      return fail( OPTION_ENOMEM, nullptr, argv[i], std::strlen( argv[i] ), i );
+    if( positional != nullptr )
+      parser_.positional = positional + positionals;
+    error = choice_parse( &parser_, argc - (i - 1), argv + (i - 1) );
+    parser_.positional = positional;
+    parser_.positionals += positionals;
+    parser_.index += i - 1;
+    if( error )
+      parser_.error.index += i - 1;
+    return error;
+  }
+};
+
+} // namespace choice
+
+#endif
@@ -20,10 +20,6 @@ static struct {
   1024
 };
 
-int option_subcommand() {
-  return 0;
-}
-
 static option_t subopts[] = {
   { "rw", "read-write mode", '\0', OPTION_NODASH, &option_true, &config.write },
   { "ro", "read-only mode", '\0', OPTION_NODASH, &option_false, &config.write },
@@ -41,7 +37,7 @@ static option_t options[] = {
   { "verbose", "enable verbose stuff", 'v', 0, &option_true, &config.verbose },
   { "required", "required arg", 'r', OPTION_REQARG, &option_str, &config.required },
   { "help", "display help", 'h', 0, &option_true, &config.help },
-  { "install", "the install subcommand", '\0', OPTION_NODASH, &option_subcommand, &(insopts[0]) },
+  OPTION_COMMAND( "install", "the install subcommand", insopts ),
   OPTION_EOL
 };
 
@@ -65,7 +61,11 @@ static void help() {
 }
 
 int main( int argc, char* argv[] ) {
-  option_parse( &(options[0]), argc, argv );
+  option_table_t table;
+
+  option_table_init( &table, &(options[0]) );
+  option_table_parse( &table, argc, argv );
+  option_table_free( &table );
 
   if( config.help ) {
     help();
@@ -0,0 +1,151 @@
+/* -*- Mode: C++; tab-width: 2; c-basic-offset: 2 -*- */
+/* vim:set softtabstop=2 shiftwidth=2: */
+/*
+ * choice-hpp-test -- do the C++ bindings do what the C parser does?
+ *
+ * Parses argument vectors through a `constexpr` table of `choice.hpp`:
+ * every kind of member it stores into, names that are not exact (which
+ * go on to the C parser), the same options through `option_parse`, and
+ * a table made at run time with a name used twice. Exits with 1 if any
+ * of them goes wrong.
+ *
+ * ---------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Jonas Pommerening <jonas.pommerening@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE  FOR  ANY  DIRECT,  INDIRECT,  INCIDENTAL,  SPECIAL,  EXEMPLARY,  OR
+ * CONSEQUENTIAL  DAMAGES  (INCLUDING,  BUT  NOT  LIMITED  TO,  PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES;  LOSS OF USE, DATA, OR PROFITS;  OR BUSINESS
+ * INTERRUPTION)  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,  WHETHER IN
+ * CONTRACT,  STRICT LIABILITY,  OR TORT  (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "choice.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <string_view>
+
+struct config_t {
+  bool verbose;
+  long level;
+  std::string_view name;
+  const char* path;
+  double ratio;
+  unsigned long long size;
+  unsigned long long timeout;
+  int counted;
+};
+
+static int count( config_t& config, const char* arg ) {
+  config.counted++;
+  return 0;
+}
+
+constexpr auto table = choice::make_table(
+  choice::flag( "verbose", "enable verbose stuff", 'v', &config_t::verbose ),
+  choice::unflag( "quiet", "disable verbose stuff", 'q', &config_t::verbose ),
+  choice::value( "level", "how much", 'l', &config_t::level ).optional(),
+  choice::value( "name", "who", 'n', &config_t::name ),
+  choice::value( "path", "where", 'p', &config_t::path ),
+  choice::value( "ratio", "how fast", 'r', &config_t::ratio ),
+  choice::size( "size", "how large", 's', &config_t::size ),
+  choice::duration( "timeout", "how long", 't', &config_t::timeout ),
+  choice::call( "count", "count up", 'c', 0, &count ) );
+
+/* every kind of member, by exact name and abbreviation */
+static bool typed( void ) {
+  const char* argv[] = {
+    "test", "-v", "--level=3", "--name", "bob", "-pfile", "-r", "0.5", "--size=2k",
+    "--timeout", "2ms", "-cc", "--count"
+  };
+  config_t config = {};
+  choice::bound<config_t, table.options.size()> options( table, config );
+  int error = options.parse( sizeof(argv) / sizeof(argv[0]), argv );
+
+  printf( "  level %li, name %.*s, path %s, ratio %g, size %llu, timeout %llu, counted %i\n",
+          config.level, (int) config.name.size(), config.name.data(), config.path, config.ratio,
+          config.size, config.timeout, config.counted );
+  return error == 0 && config.verbose && config.level == 3 && config.name == "bob" &&
+         std::string_view( config.path ) == "file" && config.ratio == 0.5 && config.size == 2000 &&
+         config.timeout == 2000000 && config.counted == 3 && options.parser().index == 13;
+}
+
+/* names that are not exact are left to the C parser, from there on */
+static bool fallback( void ) {
+  const char* argv[] = { "test", "-q", "--levl=4", "--nmae", "al", "-v", "--bogus-thing" };
+  config_t config = { true };
+  choice::bound<config_t, table.options.size()> options( table, config );
+  int error = options.parse( 6, argv );
+  bool good = error == 0 && config.verbose && config.level == 4 && config.name == "al";
+
+  error = options.parse( 7, argv );
+  printf( "  level %li, name %.*s, then error %i at %i\n", config.level,
+          (int) config.name.size(), config.name.data(), error, options.parser().error.index );
+  return good && error == OPTION_EINVAL && options.parser().error.index == 6;
+}
+
+/* the same options, as an option_t[] for the C API (which writes into `argv`) */
+static bool c_options( void ) {
+  char args[][16] = { "test", "--verbose", "--level", "7", "--name=x", "--sise=1k", "-c" };
+  char* argv[] = { args[0], args[1], args[2], args[3], args[4], args[5], args[6] };
+  config_t config = {};
+  choice::bound<config_t, table.options.size()> options( table, config );
+  int error = option_parse( options.options(), 7, argv );
+
+  option_parse_release();
+  return error == 0 && config.verbose && config.level == 7 && config.name == "x" &&
+         config.size == 1000 && config.counted == 1;
+}
+
+/* a table made at run time can not be checked by the compiler */
+static bool duplicates( void ) {
+  std::string_view level = "level";
+  bool names = false, abbrs = false;
+
+  try {
+    choice::make_table( choice::value( "level", "how much", 'l', &config_t::level ),
+                        choice::value( level, "how much again", 'L', &config_t::level ) );
+  } catch( const std::invalid_argument& ) {
+    names = true;
+  }
+  try {
+    choice::make_table( choice::value( "level", "how much", 'l', &config_t::level ),
+                        choice::flag( "loud", "be loud", 'l', &config_t::verbose ) );
+  } catch( const std::invalid_argument& ) {
+    abbrs = true;
+  }
+  return names && abbrs;
+}
+
+int main( int argc, char* argv[] ) {
+  static const struct { const char* name; bool (*test)( void ); } tests[] = {
+    { "typed", &typed }, { "fallback", &fallback }, { "c options", &c_options },
+    { "duplicates", &duplicates }
+  };
+  bool good, all = true;
+
+  for( const auto& test : tests ) {
+    printf( "%s:\n", test.name );
+    good = test.test();
+    printf( "  %s\n", good ? "ok" : "failed" );
+    all = all && good;
+  }
+  return all ? 0 : 1;
+}